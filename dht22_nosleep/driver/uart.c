@@ -11,6 +11,7 @@
 *******************************************************************************/
 #include "ets_sys.h"
 #include "osapi.h"
+#include "user_interface.h"
 #include "driver/uart.h"
 
 #define UART0   0
@@ -19,6 +20,23 @@
 // UartDev is defined and initialized in rom code.
 extern UartDevice UartDev;
 
+// Log output ring, filled by uart_log_write_char, drained by the interrupt
+LOCAL uint8 tx_ring[UART_TX_RING_SIZE];
+LOCAL volatile uint16 tx_head;      // written by the producer only
+LOCAL volatile uint16 tx_tail;      // written by the interrupt only
+LOCAL uint32 tx_dropped;
+
+// Receive ring. The first UART_RX_LINE_MAX bytes are mirrored past the
+// end, so every line of up to that length is contiguous at rx_ring[start].
+LOCAL uint8 rx_ring[UART_RX_RING_SIZE + UART_RX_LINE_MAX];
+LOCAL volatile uint16 rx_head;      // written by the interrupt only
+LOCAL volatile uint16 rx_tail;      // written by the task only
+LOCAL volatile uint8 rx_posted;
+LOCAL uint16 rx_scan;               // task: next byte to look at for a line end
+LOCAL uint32 rx_overruns;
+LOCAL uart_rx_line_cb rx_line_cb;
+LOCAL os_event_t rx_events[UART_RX_EVENTS];
+
 LOCAL void uart0_rx_intr_handler(void *para);
 
 /******************************************************************************
@@ -53,60 +71,110 @@ uart_config(uint8 uart_no)
     SET_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
     CLEAR_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
 
-    //set rx fifo trigger
-    WRITE_PERI_REG(UART_CONF1(uart_no), (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S);
+    //set rx fifo trigger and idle timeout, and the tx fifo level that asks for a refill
+    WRITE_PERI_REG(UART_CONF1(uart_no), ((UART_RX_FULL_THRESHOLD & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S)
+                   | ((UART_RX_TIMEOUT & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN
+                   | ((UART_TX_EMPTY_THRESHOLD & UART_TXFIFO_EMPTY_THRHD) << UART_TXFIFO_EMPTY_THRHD_S));
 
     //clear all interrupt
     WRITE_PERI_REG(UART_INT_CLR(uart_no), 0xffff);
     //enable rx_interrupt
-    SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
+    SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA | UART_RXFIFO_OVF_INT_ENA);
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_fill
+ * Description  : Internal used function
+ *                Move ring bytes into the log port's TX FIFO while it has
+ *                room; mask the FIFO empty interrupt once the ring is empty
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void
+uart_tx_fill(void)
+{
+    uint16 tail = tx_tail;
+    uint32 fifo_cnt = (READ_PERI_REG(UART_STATUS(UART_LOG_PORT)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT;
+
+    while (tail != tx_head && fifo_cnt < 126) {
+        WRITE_PERI_REG(UART_FIFO(UART_LOG_PORT), tx_ring[tail]);
+        tail = (tail + 1) & (UART_TX_RING_SIZE - 1);
+        fifo_cnt++;
+    }
+    tx_tail = tail;
+
+    if (tail == tx_head) {
+        CLEAR_PERI_REG_MASK(UART_INT_ENA(UART_LOG_PORT), UART_TXFIFO_EMPTY_INT_ENA);
+    }
+    WRITE_PERI_REG(UART_INT_CLR(UART_LOG_PORT), UART_TXFIFO_EMPTY_INT_CLR);
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_start
+ * Description  : Internal used function
+ *                Unmask the TX FIFO empty interrupt after the ring was filled
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_FLASH_ATTR
+uart_tx_start(void)
+{
+    if (!(READ_PERI_REG(UART_INT_ENA(UART_LOG_PORT)) & UART_TXFIFO_EMPTY_INT_ENA)) {
+        // the handler clears the enable bit, keep it out of this read-modify-write
+        ETS_UART_INTR_DISABLE();
+        SET_PERI_REG_MASK(UART_INT_ENA(UART_LOG_PORT), UART_TXFIFO_EMPTY_INT_ENA);
+        ETS_UART_INTR_ENABLE();
+    }
 }
 
 /******************************************************************************
- * FunctionName : uart1_tx_one_char
+ * FunctionName : uart_tx_ring_put
  * Description  : Internal used function
- *                Use uart1 interface to transfer one char
+ *                Queue one char for the log port. Never waits for the
+ *                FIFO; the char is counted and dropped if the ring is full
  * Parameters   : uint8 TxChar - character to tx
- * Returns      : OK
+ * Returns      : OK, or FAIL if the char was dropped
 *******************************************************************************/
 LOCAL STATUS ICACHE_FLASH_ATTR
-uart1_tx_one_char(uint8 TxChar)
+uart_tx_ring_put(uint8 TxChar)
 {
-    while (true)
-	{
-		uint32 fifo_cnt = READ_PERI_REG(UART_STATUS(UART1)) & (UART_TXFIFO_CNT<<UART_TXFIFO_CNT_S);
-		if ((fifo_cnt >> UART_TXFIFO_CNT_S & UART_TXFIFO_CNT) < 126) {
-			break;
-		}
-	}
-
-	WRITE_PERI_REG(UART_FIFO(UART1) , TxChar);
-	return OK;
+    uint16 next = (tx_head + 1) & (UART_TX_RING_SIZE - 1);
+
+    if (next == tx_tail) {
+        tx_dropped++;
+        return FAIL;
+    }
+    tx_ring[tx_head] = TxChar;
+    tx_head = next;
+    uart_tx_start();
+    return OK;
 }
 
 /******************************************************************************
- * FunctionName : uart1_write_char
+ * FunctionName : uart_log_write_char
  * Description  : Internal used function
  *                Do some special deal while tx char is '\r' or '\n'
  * Parameters   : char c - character to tx
  * Returns      : NONE
 *******************************************************************************/
 LOCAL void ICACHE_FLASH_ATTR
-uart1_write_char(char c)
+uart_log_write_char(char c)
 {
     if (c == '\n') {
-        uart1_tx_one_char('\r');
-        uart1_tx_one_char('\n');
+        uart_tx_ring_put('\r');
+        uart_tx_ring_put('\n');
     } else if (c == '\r') {
     } else {
-        uart1_tx_one_char(c);
+        uart_tx_ring_put(c);
     }
 }
 
 /******************************************************************************
  * FunctionName : uart0_rx_intr_handler
  * Description  : Internal used function
- *                UART0 interrupt handler, add self handle code inside
+ *                UART0 interrupt handler: refills the log port's TX FIFO
+ *                and moves received bytes into rx_ring, posting the RX task
+ *                once a line is complete
  * Parameters   : void *para - point to ETS_UART_INTR_ATTACH's arg
  * Returns      : NONE
 *******************************************************************************/
@@ -116,37 +184,90 @@ uart0_rx_intr_handler(void *para)
     /* uart0 and uart1 intr combine togther, when interrupt occur, see reg 0x3ff20020, bit2, bit0 represents
      * uart1 and uart0 respectively
      */
-    RcvMsgBuff *pRxBuff = (RcvMsgBuff *)para;
+    uint32 status;
+    uint16 head, next;
     uint8 RcvChar;
+    bool eol = 0;
 
-    if (UART_RXFIFO_FULL_INT_ST != (READ_PERI_REG(UART_INT_ST(UART0)) & UART_RXFIFO_FULL_INT_ST)) {
-        return;
+    if (READ_PERI_REG(UART_INT_ST(UART_LOG_PORT)) & UART_TXFIFO_EMPTY_INT_ST) {
+        uart_tx_fill();
     }
 
-    WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR);
+    status = READ_PERI_REG(UART_INT_ST(UART0)) & (UART_RXFIFO_FULL_INT_ST | UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_OVF_INT_ST);
+    if (!status) {
+        return;
+    }
+    if (status & UART_RXFIFO_OVF_INT_ST) {
+        // the FIFO overflowed before we got here, its lost bytes are uncounted
+        rx_overruns++;
+    }
 
+    head = rx_head;
     while (READ_PERI_REG(UART_STATUS(UART0)) & (UART_RXFIFO_CNT << UART_RXFIFO_CNT_S)) {
         RcvChar = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
 
-        /* you can add your handle code below.*/
+        next = (head + 1) & (UART_RX_RING_SIZE - 1);
+        if (next == rx_tail) {
+            rx_overruns++;
+            continue;
+        }
+        rx_ring[head] = RcvChar;
+        if (head < UART_RX_LINE_MAX) {
+            rx_ring[UART_RX_RING_SIZE + head] = RcvChar;
+        }
+        head = next;
+        if (RcvChar == '\r' || RcvChar == '\n') {
+            eol = 1;
+        }
+    }
+    rx_head = head;
+
+    // clear after draining, the FIFO full status follows the fill level
+    WRITE_PERI_REG(UART_INT_CLR(UART0), status);
 
-        *(pRxBuff->pWritePos) = RcvChar;
+    if ((eol || ((head - rx_tail) & (UART_RX_RING_SIZE - 1)) >= UART_RX_LINE_MAX) && !rx_posted) {
+        rx_posted = system_os_post(UART_RX_TASK_PRIO, 0, 0);
+    }
+}
 
-        // insert here for get one command line from uart
-        if (RcvChar == '\r') {
-            pRxBuff->BuffState = WRITE_OVER;
-        }
+/******************************************************************************
+ * FunctionName : uart_rx_task
+ * Description  : Internal used function
+ *                Hand every complete line to the consumer as a pointer into
+ *                rx_ring, then free its bytes. A line that reaches
+ *                UART_RX_LINE_MAX without a terminator is passed on as is.
+ * Parameters   : os_event_t *event - unused
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_FLASH_ATTR
+uart_rx_task(os_event_t *event)
+{
+    uint16 head, len;
+    uint8 c;
 
-        pRxBuff->pWritePos++;
+    rx_posted = 0;
+    head = rx_head;
 
-        if (pRxBuff->pWritePos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
-            // overflow ...we may need more error handle here.
-            pRxBuff->pWritePos = pRxBuff->pRcvMsgBuff ;
+    while (rx_scan != head) {
+        c = rx_ring[rx_scan];
+        rx_scan = (rx_scan + 1) & (UART_RX_RING_SIZE - 1);
+        len = (rx_scan - rx_tail) & (UART_RX_RING_SIZE - 1);
+
+        if (c == '\r' || c == '\n') {
+            // without the terminator, the empty half of a \r\n is skipped
+            if (len > 1 && rx_line_cb) {
+                rx_line_cb(&rx_ring[rx_tail], len - 1);
+            }
+            rx_tail = rx_scan;
+        } else if (len >= UART_RX_LINE_MAX) {
+            if (rx_line_cb) {
+                rx_line_cb(&rx_ring[rx_tail], len);
+            }
+            rx_tail = rx_scan;
         }
     }
 }
 
-
 /******************************************************************************
  * FunctionName : uart0_tx_buffer
  * Description  : use uart0 to transfer buffer
@@ -179,9 +300,95 @@ uart_init(UartBautRate uart0_br, UartBautRate uart1_br)
     uart_config(UART0);
     UartDev.baut_rate = uart1_br;
     uart_config(UART1);
+    system_os_task(uart_rx_task, UART_RX_TASK_PRIO, rx_events, UART_RX_EVENTS);
     ETS_UART_INTR_ENABLE();
 
-    // install uart1 putc callback
-    os_install_putc1((void *)uart1_write_char);
+    // os_printf output goes through the interrupt driven ring
+    os_install_putc1((void *)uart_log_write_char);
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_write
+ * Description  : queue a block for the log port as is, e.g. a binary record.
+ *                The block is dropped whole if the ring lacks room for it
+ * Parameters   : const uint8 *buf - data to tx
+ *                uint16 len - data len
+ * Returns      : OK, or FAIL if the block was dropped
+*******************************************************************************/
+STATUS ICACHE_FLASH_ATTR
+uart_tx_write(const uint8 *buf, uint16 len)
+{
+    uint16 head = tx_head;
+    uint16 i;
+
+    if (((tx_tail - head - 1) & (UART_TX_RING_SIZE - 1)) < len) {
+        tx_dropped += len;
+        return FAIL;
+    }
+    for (i = 0; i < len; i++) {
+        tx_ring[head] = buf[i];
+        head = (head + 1) & (UART_TX_RING_SIZE - 1);
+    }
+    tx_head = head;
+    uart_tx_start();
+    return OK;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_dropped
+ * Description  : chars lost to a full log ring since uart_init
+ * Parameters   : NONE
+ * Returns      : drop count
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR
+uart_tx_dropped(void)
+{
+    return tx_dropped;
+}
+
+/******************************************************************************
+ * FunctionName : uart_rx_set_callback
+ * Description  : install the consumer of received lines. It runs from the
+ *                RX task; line points into the receive ring, is not NUL
+ *                terminated and is only valid until the callback returns
+ * Parameters   : uart_rx_line_cb cb - line consumer, NULL discards input
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_rx_set_callback(uart_rx_line_cb cb)
+{
+    rx_line_cb = cb;
+}
+
+/******************************************************************************
+ * FunctionName : uart_rx_overruns
+ * Description  : bytes lost to a full receive ring, plus RX FIFO overflows,
+ *                since uart_init
+ * Parameters   : NONE
+ * Returns      : overrun count
+*******************************************************************************/
+uint32 ICACHE_FLASH_ATTR
+uart_rx_overruns(void)
+{
+    return rx_overruns;
+}
+
+/******************************************************************************
+ * FunctionName : uart_tx_flush
+ * Description  : wait until the log ring and the TX FIFO are empty, e.g.
+ *                before deep sleep cuts the output off
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart_tx_flush(void)
+{
+    while (tx_tail != tx_head) {
+        ETS_UART_INTR_DISABLE();
+        uart_tx_fill();
+        ETS_UART_INTR_ENABLE();
+    }
+    while ((READ_PERI_REG(UART_STATUS(UART_LOG_PORT)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT)
+        ;
 }
 
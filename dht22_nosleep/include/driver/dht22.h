@@ -37,9 +37,8 @@ struct dht_sensor_data {
 	BOOL success;
 };
 
-#define DHT_MAXTIMINGS	10000
-#define DHT_BREAKTIME	20
-#define DHT_MAXCOUNT	32000
+#define DHT_BREAKTIME	48	// us of high time that separates a 0 from a 1
+#define DHT_TIMEOUT	200	// us, longest level in a valid frame
 #define DHT_MUX			PERIPHS_IO_MUX_GPIO2_U
 #define DHT_FUNC		FUNC_GPIO2
 #define DHT_PIN			2
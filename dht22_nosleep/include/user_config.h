@@ -1,8 +1,17 @@
 #ifndef _USER_CONFIG_H_
 #define _USER_CONFIG_H_
 
-#define HTTP_DEBUG	false
-#define DHT22_DEBUG	false
+// Log level per module: LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO or
+// LOG_DEBUG, see log.h. Messages above it are compiled out.
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		LOG_DEBUG	// LOG_NONE for a release build
+#endif
+#define LOG_LEVEL_HTTP		LOG_ERROR
+#define LOG_LEVEL_DHT22		LOG_DEBUG
+
+// Time each upload with CCOUNT probes and print them when it completes,
+// convert the log with tools/prof_trace.py
+//#define PROF_ENABLE
 
 //#define WIFI_CLIENTSSID		"MYAP"
 //#define WIFI_CLIENTPASSWORD	"00000000"
@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+"""
+Turn prof_dump() output (driver/prof.c) into Chrome trace JSON.
+
+Reads a UART log, which may hold several dumps (one per wake cycle) among
+other output, and writes one trace with a row per cycle. Open it in
+chrome://tracing or https://ui.perfetto.dev.
+
+    prof_trace.py uart.log > trace.json
+
+Each event carries the CCOUNT and system_get_time() >> 10. Timestamps come
+from CCOUNT; the coarse time decides how many times it wrapped between two
+events, and places the first event of a dump relative to boot.
+"""
+
+import argparse
+import json
+import sys
+
+WRAP = 1 << 32
+
+
+def unwrap(events, mhz):
+    """Yield (phase, name, us since boot) for one dump."""
+    prev = None
+    t = 0.0
+    for phase, name, ccount, coarse in events:
+        if prev is None:
+            t = coarse * 1024.0
+        else:
+            ticks = (ccount - prev[0]) % WRAP
+            gap = ((coarse - prev[1]) % 65536) * 1024.0 * mhz
+            wraps = max(0, int(round((gap - ticks) / WRAP)))
+            t += (ticks + wraps * WRAP) / float(mhz)
+        prev = (ccount, coarse)
+        yield phase, name, t
+
+
+def cycles(lines):
+    """Yield (mhz, lost, events) for every complete dump in the log."""
+    dump = None
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 2 or fields[0] != 'PROF':
+            continue
+        if fields[1] == 'start' and len(fields) >= 5:
+            dump = (int(fields[2]), int(fields[4]), [])
+        elif fields[1] == 'end' and dump is not None:
+            yield dump
+            dump = None
+        elif fields[1] in ('B', 'E') and dump is not None and len(fields) >= 5:
+            dump[2].append((fields[1], fields[2], int(fields[3], 16), int(fields[4])))
+
+
+def trace(lines):
+    out = []
+    for cycle, (mhz, lost, events) in enumerate(cycles(lines), 1):
+        out.append({'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': cycle,
+                    'args': {'name': 'wake %d' % cycle + (' (%d events lost)' % lost if lost else '')}})
+        open_at = {}
+        last = 0.0
+        for phase, name, t in unwrap(events, mhz):
+            last = t
+            if phase == 'B':
+                open_at.setdefault(name, []).append(t)
+            elif open_at.get(name):
+                begin = open_at[name].pop()
+                out.append({'name': name, 'ph': 'X', 'pid': 1, 'tid': cycle,
+                            'ts': round(begin, 3), 'dur': round(t - begin, 3)})
+            else:
+                # its begin was overwritten in the ring
+                out.append({'name': name, 'ph': 'i', 's': 't', 'pid': 1, 'tid': cycle,
+                            'ts': round(t, 3), 'args': {'unmatched': 'end'}})
+        for name, begins in open_at.items():
+            # still running when dumped, e.g. WAKE or a failed connect
+            for begin in begins:
+                out.append({'name': name, 'ph': 'X', 'pid': 1, 'tid': cycle,
+                            'ts': round(begin, 3), 'dur': round(last - begin, 3),
+                            'args': {'unmatched': 'begin'}})
+    return {'traceEvents': out, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    ap.add_argument('log', nargs='?', help='UART log (default stdin)')
+    opts = ap.parse_args()
+
+    f = open(opts.log, errors='replace') if opts.log else sys.stdin
+    json.dump(trace(f), sys.stdout, indent=1)
+    sys.stdout.write('\n')
+
+
+if __name__ == '__main__':
+    main()
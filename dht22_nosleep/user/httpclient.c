@@ -16,15 +16,13 @@
 #include "mem.h"
 #include "limits.h"
 #include "httpclient.h"
+#include "driver/prof.h"
 
 
 // Debug output.
-#ifdef HTTP_DEBUG
-#undef HTTP_DEBUG
-#define HTTP_DEBUG(...) os_printf(__VA_ARGS__);
-#else
-#define HTTP_DEBUG(...)
-#endif
+#define LOG_MODULE_LEVEL LOG_LEVEL_HTTP
+#include "log.h"
+#define HTTP_DEBUG(...) LOG_D(__VA_ARGS__)
 
 // Internal state.
 typedef struct {
@@ -46,7 +44,7 @@ static char * ICACHE_FLASH_ATTR esp_strdup(const char * str)
 	}
 	char * new_str = (char *)os_malloc(os_strlen(str) + 1); // 1 for null character
 	if (new_str == NULL) {
-		os_printf("esp_strdup: malloc error");
+		LOG_E("esp_strdup: malloc error");
 		return NULL;
 	}
 	os_strcpy(new_str, str);
@@ -217,7 +215,7 @@ static void ICACHE_FLASH_ATTR receive_callback(void * arg, char * buf, unsigned
 	const int new_size = req->buffer_size + len;
 	char * new_buffer;
 	if (new_size > BUFFER_SIZE_MAX || NULL == (new_buffer = (char *)os_malloc(new_size))) {
-		os_printf("Response too long (%d)\n", new_size);
+		LOG_E("Response too long (%d)\n", new_size);
 		req->buffer[0] = '\0'; // Discard the buffer to avoid using an incomplete response.
 		if (req->secure)
 			espconn_secure_disconnect(conn);
@@ -257,6 +255,7 @@ static void ICACHE_FLASH_ATTR sent_callback(void * arg)
 
 static void ICACHE_FLASH_ATTR connect_callback(void * arg)
 {
+	PROF_END(PROF_HTTP_CONNECT);
 	HTTP_DEBUG("Connected\n");
 	struct espconn * conn = (struct espconn *)arg;
 	request_args * req = (request_args *)conn->reverse;
@@ -291,10 +290,12 @@ static void ICACHE_FLASH_ATTR connect_callback(void * arg)
 	os_free(req->headers);
 	req->headers = NULL;
 	HTTP_DEBUG("Sending request header\n");
+	PROF_BEGIN(PROF_HTTP_RESPONSE);
 }
 
 static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
 {
+	PROF_END(PROF_HTTP_RESPONSE);
 	HTTP_DEBUG("Disconnected\n");
 	struct espconn *conn = (struct espconn *)arg;
 
@@ -307,14 +308,14 @@ static void ICACHE_FLASH_ATTR disconnect_callback(void * arg)
 		int http_status = -1;
 		char * body = "";
 		if (req->buffer == NULL) {
-			os_printf("Buffer shouldn't be NULL\n");
+			LOG_E("Buffer shouldn't be NULL\n");
 		}
 		else if (req->buffer[0] != '\0') {
 			// FIXME: make sure this is not a partial response, using the Content-Length header.
 
 			const char * version = "HTTP/1.1 ";
 			if (os_strncmp(req->buffer, version, strlen(version)) != 0) {
-				os_printf("Invalid version in %s\n", req->buffer);
+				LOG_E("Invalid version in %s\n", req->buffer);
 			}
 			else {
 				http_status = atoi(req->buffer + strlen(version));
@@ -357,8 +358,9 @@ static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * ad
 {
 	request_args * req = (request_args *)arg;
 
+	PROF_END(PROF_HTTP_DNS);
 	if (addr == NULL) {
-		os_printf("DNS failed for %s\n", hostname);
+		LOG_E("DNS failed for %s\n", hostname);
 		if (req->user_callback != NULL) {
 			req->user_callback("", -1, "");
 		}
@@ -381,6 +383,7 @@ static void ICACHE_FLASH_ATTR dns_callback(const char * hostname, ip_addr_t * ad
 		espconn_regist_disconcb(conn, disconnect_callback);
 		espconn_regist_reconcb(conn, error_callback);
 
+		PROF_BEGIN(PROF_HTTP_CONNECT);
 		if (req->secure) {
 			espconn_secure_set_size(ESPCONN_CLIENT,5120); // set SSL buffer size
 			espconn_secure_connect(conn);
@@ -407,6 +410,7 @@ void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool se
 	req->user_callback = user_callback;
 
 	ip_addr_t addr;
+	PROF_BEGIN(PROF_HTTP_DNS);
 	err_t error = espconn_gethostbyname((struct espconn *)req, // It seems we don't need a real espconn pointer here.
 										hostname, &addr, dns_callback);
 
@@ -419,10 +423,10 @@ void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool se
 	}
 	else {
 		if (error == ESPCONN_ARG) {
-			os_printf("DNS arg error %s\n", hostname);
+			LOG_E("DNS arg error %s\n", hostname);
 		}
 		else {
-			os_printf("DNS error code %d\n", error);
+			LOG_E("DNS error code %d\n", error);
 		}
 		dns_callback(hostname, NULL, req); // Handle all DNS errors the same way.
 	}
@@ -452,7 +456,7 @@ void ICACHE_FLASH_ATTR http_post(const char * url, const char * post_data, const
 		secure = true;
 		url += strlen("https://"); // Get rid of the protocol.
 	} else {
-		os_printf("URL is not HTTP or HTTPS %s\n", url);
+		LOG_E("URL is not HTTP or HTTPS %s\n", url);
 		return;
 	}
 
@@ -473,7 +477,7 @@ void ICACHE_FLASH_ATTR http_post(const char * url, const char * post_data, const
 	else {
 		port = atoi(colon + 1);
 		if (port == 0) {
-			os_printf("Port error %s\n", url);
+			LOG_E("Port error %s\n", url);
 			return;
 		}
 
@@ -22,6 +22,7 @@
 #include "httpclient.h"
 #include "driver/uart.h"
 #include "driver/dht22.h"
+#include "driver/prof.h"
 #include "user_config.h"
 
 typedef enum {
@@ -45,6 +46,10 @@ static tConnState connState = WIFI_CONNECTING;
 
 LOCAL void ICACHE_FLASH_ATTR thingspeak_http_callback(char * response, int http_status, char * full_response)
 {
+#ifdef PROF_ENABLE
+	uart_tx_flush();	// keep queued log output out of the dump
+	prof_dump();
+#endif
 	if (http_status == 200)
 	{
 	}
@@ -64,7 +69,9 @@ LOCAL void ICACHE_FLASH_ATTR dht22_cb(void *arg)
 	os_timer_disarm(&dht22_timer);
 	if(connState == WIFI_CONNECTED)
 	{
+        PROF_BEGIN(PROF_DHT_READ);
         r = DHTRead();
+        PROF_END(PROF_DHT_READ);
         lastTemp = r->temperature;
         lastHum = r->humidity;
         unsigned int vdd = readvdd33();
@@ -135,6 +142,7 @@ static ETSTimer sleep_timer;
 LOCAL void ICACHE_FLASH_ATTR sleep_cb(void *arg)
 {
     os_timer_disarm(&sleep_timer);
+    uart_tx_flush();
     system_deep_sleep_set_option( 1 );
     system_deep_sleep(60*1000*1000);//second*1000*1000
 }
@@ -151,6 +159,8 @@ void user_init(void)
 	system_set_os_print(1);
 	os_delay_us(10000);
 
+	prof_init();
+	PROF_BEGIN(PROF_WIFI_ASSOC);
 	if(wifi_get_opmode() != STATION_MODE)
 	{
 		setup_wifi_st_mode();
@@ -0,0 +1,58 @@
+/*
+    Deferred binary logging, see include/driver/blog.h
+*/
+
+#include <stdarg.h>
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+#include "driver/blog.h"
+
+static uint32 blog_last;
+
+LOCAL uint8 ICACHE_FLASH_ATTR
+blog_varint(uint8 *p, uint32 v)
+{
+	uint8 n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/*
+ * Encode one record and queue it on the UART log ring. A record that
+ * does not fit is dropped whole and counted in uart_tx_dropped().
+ */
+void ICACHE_FLASH_ATTR
+blog_write(uint16 id, int nargs, ...)
+{
+	uint8 rec[BLOG_MAX_RECORD];
+	uint8 len = 0;
+	uint32 now = system_get_time();
+	sint32 arg;
+	va_list ap;
+
+	if (nargs > BLOG_MAX_ARGS)
+		nargs = BLOG_MAX_ARGS;
+	rec[len++] = BLOG_SYNC | nargs;
+	rec[len++] = id & 0xff;
+	rec[len++] = id >> 8;
+	len += blog_varint(rec + len, now - blog_last);
+	blog_last = now;
+
+	va_start(ap, nargs);
+	while (nargs--) {
+		arg = va_arg(ap, sint32);
+		// zigzag, small negative numbers stay short
+		len += blog_varint(rec + len, arg < 0 ? ((uint32)~arg << 1) | 1 : (uint32)arg << 1);
+	}
+	va_end(ap);
+
+	uart_tx_write(rec, len);
+}
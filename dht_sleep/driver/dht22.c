@@ -25,12 +25,17 @@
 #include "user_interface.h"
 #include "gpio.h"
 #include "driver/dht22.h"
+#include "driver/bitbang.h"
+
+#define BLOG_FILE 1
+#include "driver/blog.h"
+#define LOG_MODULE_LEVEL LOG_LEVEL_DHT22
+#define LOG_PRINTF BLOG
+#include "log.h"
 
 enum DHTType sensor_type;
 #define sleepms(x) os_delay_us(x*1000);
 
-extern int ets_uart_printf(const char *fmt, ...);
-
 static inline float scale_humidity(int *data) {
 	if(sensor_type == DHT11) {
 		return data[0];
@@ -54,23 +59,64 @@ static inline float scale_temperature(int *data) {
 	}
 }
 
+//
+// Time how long the pin stays at level, in us; -1 after timeout us.
+// Runs with interrupts masked from IRAM, see bitbang.h.
+//
+static inline int dht_pulse(int level, uint32 timeout)
+{
+	uint32 start = bb_ccount();
+	uint32 limit = timeout * bb_ticks_per_us;
+	while (GPIO_INPUT_GET(DHT_PIN) == level)
+		if (bb_ccount() - start > limit)
+			return -1;
+	return (bb_ccount() - start) / bb_ticks_per_us;
+}
+
+//
+// Read the 40 bit frame that follows the start signal. Returns the
+// number of bits stored in data, or -1 if the sensor did not respond.
+//
+LOCAL int dht_read_frame(int *data)
+{
+	int high, j;
+
+	BB_LOCK();
+	// host release, then the sensor's 80 us low / 80 us high response
+	if (dht_pulse(1, DHT_TIMEOUT) < 0 || dht_pulse(0, DHT_TIMEOUT) < 0
+			|| dht_pulse(1, DHT_TIMEOUT) < 0) {
+		BB_UNLOCK();
+		return -1;
+	}
+	// each bit is 50 us low and 26-28 us (0) or 70 us (1) high
+	for (j = 0; j < 40; j++) {
+		if (dht_pulse(0, DHT_TIMEOUT) < 0)
+			break;
+		high = dht_pulse(1, DHT_TIMEOUT);
+		if (high < 0)
+			break;
+		data[j/8] <<= 1;
+		if (high > DHT_BREAKTIME)
+			data[j/8] |= 1;
+	}
+	BB_UNLOCK();
+	return j;
+}
+
 static struct dht_sensor_data reading = {
-	.success = 0
+	.success = 0,
+	.status = DHT_OK
 };
 
-//struct dht_sensor_data *ICACHE_FLASH_ATTR DHTRead(void)
-struct dht_sensor_data* DHTRead(void)
+struct dht_sensor_data *ICACHE_FLASH_ATTR DHTRead(void)
 {
-	int counter = 0;
-	int laststate = 1;
-	int i = 0;
 	int j = 0;
 	int checksum = 0;
-	int data[100];
+	int data[5];
 	data[0] = data[1] = data[2] = data[3] = data[4] = 0;
 
 	// Wake up device, 250ms of high
-ets_uart_printf("Wake up device, 250ms of high\r\n");
+LOG_D("Wake up device, 250ms of high\r\n");
 	GPIO_OUTPUT_SET(DHT_PIN, 1);
 	sleepms(450);
 	// Hold low for 20ms
@@ -78,74 +124,48 @@ ets_uart_printf("Wake up device, 250ms of high\r\n");
 	sleepms(20);
 	// High for 40ns
 	GPIO_OUTPUT_SET(DHT_PIN, 1);
-	os_delay_us(40);
+	bb_delay_us(40);
 	// Set DHT_PIN pin as an input
 	GPIO_DIS_OUTPUT(DHT_PIN);
 
-	// wait for pin to drop?
-	while (GPIO_INPUT_GET(DHT_PIN) == 1 && i < DHT_MAXCOUNT) {
-		os_delay_us(1);
-		i++;
-	}
-
-	if(GPIO_INPUT_GET(DHT_PIN) == 1 && i == DHT_MAXCOUNT) {
+	j = dht_read_frame(data);
+	if (j < 0) {
 		reading.success = 0;
-                ets_uart_printf("Failed to get reading, dying\r\n");
+		reading.status = DHT_ERR_TIMEOUT;
+                LOG_W("Failed to get reading, dying\r\n");
                 return &reading;
         }
 
-        // read data
-        for (i = 0; i < DHT_MAXTIMINGS; i++)
-        {
-                // Count high time (in approx us)
-                counter = 0;
-                while (GPIO_INPUT_GET(DHT_PIN) == laststate)
-                {
-                        counter++;
-                        os_delay_us(1);
-                        if (counter == 1000)
-                                break;
-                }
-                laststate = GPIO_INPUT_GET(DHT_PIN);
-                if (counter == 1000)
-                        break;
-                // store data after 3 reads
-                if ((i>3) && (i%2 == 0)) {
-                        // shove each bit into the storage bytes
-                        data[j/8] <<= 1;
-                        if (counter > DHT_BREAKTIME)
-                                data[j/8] |= 1;
-                        j++;
-                }
-        }
-
-        if (j >= 39) {
+        if (j == 40) {
                 checksum = (data[0] + data[1] + data[2] + data[3]) & 0xFF;
-                ets_uart_printf("DHT: %02x %02x %02x %02x [%02x] CS: %02x\r\n", data[0], data[1],data[2],data[3],data[4],checksum);
+                LOG_D("DHT: %02x %02x %02x %02x [%02x] CS: %02x\r\n", data[0], data[1],data[2],data[3],data[4],checksum);
                 if (data[4] == checksum) {
                         // checksum is valid
                         reading.temperature = scale_temperature(data);
                         reading.humidity = scale_humidity(data);
-                        //ets_uart_printf("Temperature =  %d *C, Humidity = %d %%\r\n", (int)(reading.temperature * 100), (int)(reading.humidity * 100));
+                        //os_printf("Temperature =  %d *C, Humidity = %d %%\r\n", (int)(reading.temperature * 100), (int)(reading.humidity * 100));
                         reading.success = 1;
+                        reading.status = DHT_OK;
                 } else {
-                        ets_uart_printf("Checksum was incorrect after %d bits. Expected %d but got %d\r\n", j, data[4], checksum);
+                        LOG_W("Checksum was incorrect after %d bits. Expected %d but got %d\r\n", j, data[4], checksum);
                         reading.success = 0;
+                        reading.status = DHT_ERR_CHECKSUM;
                 }
         } else {
-                ets_uart_printf("Got too few bits: %d should be at least 40\r\n", j);
+                LOG_W("Got too few bits: %d should be at least 40\r\n", j);
                 reading.success = 0;
+                reading.status = DHT_ERR_BITS;
         }
         return &reading;
 }
 
 
-//void ICACHE_FLASH_ATTR DHTInit(enum DHTType dht_type)
-void DHTInit(enum DHTType dht_type)
+void ICACHE_FLASH_ATTR DHTInit(enum DHTType dht_type)
 {
 	sensor_type = dht_type;
 	PIN_FUNC_SELECT(DHT_MUX, DHT_FUNC);
 	PIN_PULLUP_EN(DHT_MUX);
-	ets_uart_printf("DHT setup for type %d\r\n", dht_type);
+	bb_init();
+	LOG_I("DHT setup for type %d\r\n", dht_type);
 }
 
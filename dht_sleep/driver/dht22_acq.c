@@ -0,0 +1,150 @@
+/*
+    Filtered acquisition for the DHT22 sensor
+
+    Up to DHT_ACQ_MAX_ATTEMPTS reads are taken, DHT_ACQ_MIN_INTERVAL apart,
+    until DHT_ACQ_SAMPLES of them pass the checksum and range checks. The
+    median of the good reads is compared against the last accepted value,
+    which survives deep sleep in RTC user memory.
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "user_interface.h"
+#include "driver/dht22.h"
+#include "driver/dht22_acq.h"
+
+struct dht_acq_rtc {
+	uint32 magic;
+	sint16 temperature;
+	uint16 humidity;
+	uint8 rejects;
+	uint8 pad[3];
+};
+
+static ETSTimer acq_timer;
+static dht_acq_callback acq_cb;
+static struct dht_acq_result result;
+static sint16 temp_samples[DHT_ACQ_SAMPLES];
+static sint16 hum_samples[DHT_ACQ_SAMPLES];
+
+LOCAL sint16 ICACHE_FLASH_ATTR
+dht_acq_tenths(float value)
+{
+	return (sint16)(value < 0 ? value * 10 - 0.5f : value * 10 + 0.5f);
+}
+
+LOCAL sint16 ICACHE_FLASH_ATTR
+dht_acq_median(sint16 *v, uint8 n)
+{
+	uint8 i, j;
+	sint16 t;
+
+	// insertion sort, n is tiny
+	for (i = 1; i < n; i++) {
+		t = v[i];
+		for (j = i; j > 0 && v[j - 1] > t; j--)
+			v[j] = v[j - 1];
+		v[j] = t;
+	}
+	if (n & 1)
+		return v[n / 2];
+	return (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+LOCAL int ICACHE_FLASH_ATTR
+dht_acq_abs(int v)
+{
+	return v < 0 ? -v : v;
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+dht_acq_finish(void)
+{
+	struct dht_acq_rtc rtc;
+	sint16 temperature, humidity;
+
+	result.success = 0;
+	if (result.stats.good > 0) {
+		temperature = dht_acq_median(temp_samples, result.stats.good);
+		humidity = dht_acq_median(hum_samples, result.stats.good);
+
+		system_rtc_mem_read(DHT_ACQ_RTC_BLOCK, &rtc, sizeof(rtc));
+		if (rtc.magic == DHT_ACQ_RTC_MAGIC
+				&& rtc.rejects < DHT_ACQ_MAX_REJECTS
+				&& (dht_acq_abs(temperature - rtc.temperature) > DHT_ACQ_MAX_TEMP_JUMP
+				|| dht_acq_abs(humidity - (sint16)rtc.humidity) > DHT_ACQ_MAX_HUM_JUMP)) {
+			// implausible jump, keep the old reference
+			rtc.rejects++;
+			result.stats.outliers++;
+		} else {
+			rtc.magic = DHT_ACQ_RTC_MAGIC;
+			rtc.temperature = temperature;
+			rtc.humidity = humidity;
+			rtc.rejects = 0;
+			result.temperature = temperature;
+			result.humidity = humidity;
+			result.success = 1;
+		}
+		system_rtc_mem_write(DHT_ACQ_RTC_BLOCK, &rtc, sizeof(rtc));
+	}
+	acq_cb(&result);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+dht_acq_step(void *arg)
+{
+	struct dht_sensor_data *r;
+	sint16 temperature, humidity;
+
+	os_timer_disarm(&acq_timer);
+
+	r = DHTRead();
+	result.stats.attempts++;
+	if (r->success) {
+		temperature = dht_acq_tenths(r->temperature);
+		humidity = dht_acq_tenths(r->humidity);
+		// DHT22 range is -40..80 *C and 0..100 %
+		if (temperature < -400 || temperature > 800 || humidity < 0 || humidity > 1000) {
+			result.stats.outliers++;
+		} else {
+			temp_samples[result.stats.good] = temperature;
+			hum_samples[result.stats.good] = humidity;
+			result.stats.good++;
+		}
+	} else {
+		switch (r->status) {
+		case DHT_ERR_TIMEOUT:
+			result.stats.timeouts++;
+			break;
+		case DHT_ERR_CHECKSUM:
+			result.stats.checksum_errors++;
+			break;
+		default:
+			result.stats.bad_frames++;
+		}
+	}
+
+	if (result.stats.good < DHT_ACQ_SAMPLES && result.stats.attempts < DHT_ACQ_MAX_ATTEMPTS) {
+		// the sensor needs a 2 s rest between start signals
+		os_timer_setfn(&acq_timer, (os_timer_func_t *)dht_acq_step, NULL);
+		os_timer_arm(&acq_timer, DHT_ACQ_MIN_INTERVAL, 0);
+		return;
+	}
+	dht_acq_finish();
+}
+
+/*
+ * Start a filtered acquisition. The callback runs from timer context once
+ * enough good samples were taken or the attempts ran out.
+ */
+void ICACHE_FLASH_ATTR
+DHTAcquire(dht_acq_callback cb)
+{
+	acq_cb = cb;
+	os_memset(&result, 0, sizeof(result));
+
+	os_timer_disarm(&acq_timer);
+	os_timer_setfn(&acq_timer, (os_timer_func_t *)dht_acq_step, NULL);
+	os_timer_arm(&acq_timer, 1, 0);
+}
@@ -0,0 +1,48 @@
+/*
+    Deferred binary logging
+
+    BLOG("format", args...) queues a record with the call site's ID and
+    the raw arguments on the UART log ring instead of formatting text on
+    the device; the format string is not even compiled in.
+    tools/blog_decode.py extracts the formats from the sources and
+    rebuilds the text on the host.
+
+    A source file using BLOG defines BLOG_FILE (1..15, unique within the
+    project) before including this header. The ID is then
+    BLOG_FILE << 12 | __LINE__, so keep each BLOG call on one line.
+    Arguments must be integers, at most BLOG_MAX_ARGS of them; strings
+    and floats stay on os_printf. Call from task context only.
+
+    Record: 0xF0 | nargs, ID (2 bytes, little endian), microseconds since
+    the previous record and each argument zigzag encoded, all as 7 bit
+    varints. Text bytes are never >= 0xF0, so the two mix on one port.
+*/
+
+#ifndef __BLOG_H__
+#define __BLOG_H__
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "user_config.h"
+
+#define BLOG_SYNC		0xF0
+#define BLOG_MAX_ARGS		6
+#define BLOG_MAX_RECORD		(3 + 5 + BLOG_MAX_ARGS * 5)
+
+#ifdef BLOG_ENABLE
+
+#define BLOG_ID			((BLOG_FILE << 12) | __LINE__)
+#define BLOG_NARGS(...)		BLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define BLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...)	n
+#define BLOG(fmt, ...)		blog_write(BLOG_ID, BLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+#else
+
+// text fallback, formatted on the device as before
+#define BLOG(...)		os_printf(__VA_ARGS__)
+
+#endif
+
+void blog_write(uint16 id, int nargs, ...);
+
+#endif
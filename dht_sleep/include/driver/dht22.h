@@ -31,15 +31,22 @@ enum DHTType{
 	DHT22
 };
 
+enum DHTStatus {
+	DHT_OK,
+	DHT_ERR_TIMEOUT,	// sensor did not answer the start signal
+	DHT_ERR_BITS,		// frame ended before 40 bits
+	DHT_ERR_CHECKSUM
+};
+
 struct dht_sensor_data {
 	float temperature;
 	float humidity;
 	BOOL success;
+	enum DHTStatus status;
 };
 
-#define DHT_MAXTIMINGS	10000
-#define DHT_BREAKTIME	20
-#define DHT_MAXCOUNT	32000
+#define DHT_BREAKTIME	48	// us of high time that separates a 0 from a 1
+#define DHT_TIMEOUT	200	// us, longest level in a valid frame
 #define DHT_MUX			PERIPHS_IO_MUX_GPIO2_U
 #define DHT_FUNC		FUNC_GPIO2
 #define DHT_PIN			2
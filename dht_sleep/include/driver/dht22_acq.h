@@ -0,0 +1,46 @@
+/*
+    Filtered acquisition for the DHT22 sensor
+
+    Retries failed DHTRead() calls at the sensor's minimum sampling
+    interval, reports the median of the good reads and rejects values
+    that jump implausibly far from the last value kept in RTC memory.
+*/
+
+#ifndef __DHT22_ACQ_H__
+#define __DHT22_ACQ_H__
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "driver/dht22.h"
+
+#define DHT_ACQ_MIN_INTERVAL	2000	// ms, DHT22 minimum sampling period
+#define DHT_ACQ_SAMPLES		3	// good reads to take the median of
+#define DHT_ACQ_MAX_ATTEMPTS	6	// reads before giving up
+#define DHT_ACQ_MAX_TEMP_JUMP	100	// 0.1 *C, against the last kept value
+#define DHT_ACQ_MAX_HUM_JUMP	300	// 0.1 %, against the last kept value
+#define DHT_ACQ_MAX_REJECTS	3	// accept a jump after this many rejections in a row
+
+#define DHT_ACQ_RTC_BLOCK	64	// first RTC user memory block (4 bytes each)
+#define DHT_ACQ_RTC_MAGIC	0x44485431
+
+struct dht_acq_stats {
+	uint8 attempts;
+	uint8 good;
+	uint8 timeouts;
+	uint8 bad_frames;
+	uint8 checksum_errors;
+	uint8 outliers;
+};
+
+struct dht_acq_result {
+	sint16 temperature;	// 0.1 *C
+	uint16 humidity;	// 0.1 %
+	BOOL success;
+	struct dht_acq_stats stats;
+};
+
+typedef void (*dht_acq_callback)(struct dht_acq_result *result);
+
+void DHTAcquire(dht_acq_callback cb);
+
+#endif
@@ -6,6 +6,22 @@
 #define RX_BUFF_SIZE    0x100
 #define TX_BUFF_SIZE    100
 
+// os_printf output is queued in a RAM ring and drained by the TX FIFO
+// empty interrupt. UART1 TX is GPIO2, the DHT data pin on these boards,
+// so the log goes to UART0.
+#define UART_LOG_PORT           0
+#define UART_TX_RING_SIZE       512     // power of two
+#define UART_TX_EMPTY_THRESHOLD 16      // refill when fewer bytes are left in the FIFO
+
+// UART0 input is collected in a ring and handed out a line at a time from
+// an SDK task, see uart_rx_set_callback()
+#define UART_RX_RING_SIZE       512     // power of two
+#define UART_RX_LINE_MAX        128     // longer lines are passed on in pieces
+#define UART_RX_FULL_THRESHOLD  64      // interrupt at this RX FIFO level
+#define UART_RX_TIMEOUT         2       // or after this many idle char times
+#define UART_RX_TASK_PRIO       USER_TASK_PRIO_0
+#define UART_RX_EVENTS          2
+
 typedef enum {
     FIVE_BITS = 0x0,
     SIX_BITS = 0x1,
@@ -90,7 +106,14 @@ typedef struct {
     int                      buff_uart_no;  //indicate which uart use tx/rx buffer
 } UartDevice;
 
+typedef void (*uart_rx_line_cb)(const uint8 *line, uint16 len);
+
 void uart_init(UartBautRate uart0_br, UartBautRate uart1_br);
+void uart_rx_set_callback(uart_rx_line_cb cb);
+uint32 uart_rx_overruns(void);
+STATUS uart_tx_write(const uint8 *buf, uint16 len);
+uint32 uart_tx_dropped(void);
+void uart_tx_flush(void);
 
 #endif
 
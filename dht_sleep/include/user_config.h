@@ -1,8 +1,25 @@
 #ifndef _USER_CONFIG_H_
 #define _USER_CONFIG_H_
 
-#define HTTP_DEBUG	false
-#define DHT22_DEBUG	false
+// Log level per module: LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO or
+// LOG_DEBUG, see log.h. Messages above it are compiled out.
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		LOG_DEBUG	// LOG_NONE for a release build
+#endif
+#define LOG_LEVEL_HTTP		LOG_ERROR
+#define LOG_LEVEL_MAIN		LOG_DEBUG
+#define LOG_LEVEL_DHT22		LOG_DEBUG
+
+// Log DHT22_TRACE and driver messages as binary records, decode them with
+// tools/blog_decode.py
+#define BLOG_ENABLE
+
+// Time the wake cycle with CCOUNT probes and print them before sleeping,
+// convert the log with tools/prof_trace.py
+//#define PROF_ENABLE
+// Keep each wake's phase times in RTC memory (7 blocks) and upload them
+// with the next reading, see driver/prof.h
+#define PROF_RTC_BLOCK		67	// after the DHT acquisition stats at 64..66
 
 //#define WIFI_CLIENTSSID		"MYAP"
 //#define WIFI_CLIENTPASSWORD	"00000000"
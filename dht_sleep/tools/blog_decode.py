@@ -0,0 +1,177 @@
+#!/usr/bin/env python
+"""
+Decode the binary log records written by BLOG() (driver/blog.c).
+
+The ID table maps each BLOG call site to its format string. It is
+extracted from the sources: every file that defines BLOG_FILE n
+contributes IDs n << 12 | line, for calls of BLOG, of macros defined as
+BLOG(__VA_ARGS__) and of LOG_E/W/I/D if LOG_PRINTF is BLOG. The Makefile writes it to
+build/blog_ids.json; without --table the sources are scanned directly,
+which is only right while they match the flashed firmware.
+
+Input is a raw capture of the log UART (file or stdin). Plain text
+passes through unchanged, records are printed as
+"[seconds since boot] message".
+
+    blog_decode.py --extract driver user -o build/blog_ids.json
+    blog_decode.py --table build/blog_ids.json capture.bin
+    blog_decode.py < capture.bin
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+SYNC = 0xF0
+MAX_ARGS = 6
+
+FILE_RE = re.compile(r'^\s*#\s*define\s+BLOG_FILE\s+(\d+)', re.M)
+WRAP_RE = re.compile(r'^\s*#\s*define\s+(\w+)\s*\(\.\.\.\)\s+BLOG\s*\(', re.M)
+LOG_RE = re.compile(r'^\s*#\s*define\s+LOG_PRINTF\s+BLOG\s*$', re.M)
+LIT = r'"(?:[^"\\]|\\.)*"'
+SPEC_RE = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z)?([diouxXcp%])')
+
+
+def c_unescape(lit):
+    return lit[1:-1].encode('latin-1').decode('unicode_escape')
+
+
+def extract(paths):
+    table = {}
+    files = []
+    for path in paths:
+        if os.path.isdir(path):
+            for name in sorted(os.listdir(path)):
+                if name.endswith('.c'):
+                    files.append(os.path.join(path, name))
+        else:
+            files.append(path)
+    for name in files:
+        with open(name) as f:
+            text = f.read()
+        m = FILE_RE.search(text)
+        if not m:
+            continue
+        file_id = int(m.group(1))
+        # BLOG itself, wrappers such as DHT22_TRACE(...) BLOG(__VA_ARGS__)
+        # and the log.h levels when the file sends them to BLOG
+        names = ['BLOG'] + WRAP_RE.findall(text)
+        if LOG_RE.search(text):
+            names += ['LOG_E', 'LOG_W', 'LOG_I', 'LOG_D']
+        names = '|'.join(names)
+        call_re = re.compile(r'\b(?:%s)\s*\(\s*((?:%s\s*)+)' % (names, LIT))
+        open_re = re.compile(r'\b(?:%s)\s*\(\s*$' % names)
+        for lineno, line in enumerate(text.split('\n'), 1):
+            call = call_re.search(line)
+            if not call:
+                if open_re.search(line):
+                    sys.stderr.write('%s:%d: BLOG call spans lines, skipped\n' % (name, lineno))
+                continue
+            fmt = ''.join(c_unescape(lit) for lit in re.findall(LIT, call.group(1)))
+            key = str((file_id << 12) | lineno)
+            if key in table:
+                sys.stderr.write('%s:%d: ID %s already used by %s\n' % (name, lineno, key, table[key]['where']))
+            table[key] = {'where': '%s:%d' % (os.path.basename(name), lineno), 'fmt': fmt}
+    return table
+
+
+def format_record(fmt, args):
+    args = list(args)
+
+    def conv(m):
+        flags, length, kind = m.groups()
+        if kind == '%':
+            return '%'
+        v = args.pop(0) if args else 0
+        if kind in 'ouxXp':
+            v &= 0xFFFFFFFF
+            kind = 'x' if kind == 'p' else kind
+        if kind == 'u':
+            kind = 'd'
+        if kind == 'c':
+            return chr(v & 0xFF)
+        return ('%' + flags + kind) % v
+    return SPEC_RE.sub(conv, fmt)
+
+
+def varint(data, pos):
+    v = shift = 0
+    while True:
+        if pos >= len(data):
+            return None, pos
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+
+
+def decode(data, table, out):
+    pos = 0
+    now = 0
+    text = bytearray()
+    while pos < len(data):
+        b = data[pos]
+        if b < SYNC or b - SYNC > MAX_ARGS or pos + 3 > len(data):
+            text.append(b)
+            pos += 1
+            continue
+        nargs = b - SYNC
+        rec_id = data[pos + 1] | (data[pos + 2] << 8)
+        dt, p = varint(data, pos + 3)
+        args = []
+        for i in range(nargs):
+            if dt is None:
+                break
+            v, p = varint(data, p)
+            if v is None:
+                dt = None
+                break
+            args.append(-(v >> 1) - 1 if v & 1 else v >> 1)
+        if dt is None:
+            # truncated at the end of the capture
+            break
+        out.write(text.decode('latin-1'))
+        text = bytearray()
+        now += dt
+        entry = table.get(str(rec_id))
+        if entry is None:
+            msg = 'unknown BLOG id %d:%d args %s' % (rec_id >> 12, rec_id & 0xFFF, args)
+        else:
+            msg = format_record(entry['fmt'], args).rstrip('\r\n')
+        out.write('[%10.6f] %s\n' % (now / 1e6, msg))
+        pos = p
+    out.write(text.decode('latin-1'))
+
+
+def main():
+    top = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+    ap = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    ap.add_argument('--extract', nargs='+', metavar='SRC', help='write the ID table for these sources and exit')
+    ap.add_argument('-o', '--output', help='ID table file for --extract (default stdout)')
+    ap.add_argument('--table', help='ID table written by --extract')
+    ap.add_argument('input', nargs='?', help='UART capture (default stdin)')
+    opts = ap.parse_args()
+
+    if opts.extract:
+        table = extract(opts.extract)
+        out = open(opts.output, 'w') if opts.output else sys.stdout
+        json.dump(table, out, indent=1, sort_keys=True)
+        out.write('\n')
+        return
+
+    if opts.table:
+        with open(opts.table) as f:
+            table = json.load(f)
+    else:
+        table = extract([os.path.join(top, 'driver'), os.path.join(top, 'user')])
+
+    stream = open(opts.input, 'rb') if opts.input else getattr(sys.stdin, 'buffer', sys.stdin)
+    decode(bytearray(stream.read()), table, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -22,8 +22,13 @@
 #include "httpclient.h"
 #include "driver/uart.h"
 #include "driver/dht22.h"
+#include "driver/dht22_acq.h"
+#include "driver/prof.h"
 #include "user_config.h"
 
+#define BLOG_FILE 2
+#include "driver/blog.h"
+
 /////////////////////////////////////////////////////////////////
 
 const char *FlashSizeMap[] =
@@ -45,15 +50,20 @@ const char *WiFiMode[] =
 		"STATIONAP"	// 0x03
 };
 
-extern int ets_uart_printf(const char *fmt, ...);
-int (*console_printf)(const char *fmt, ...) = ets_uart_printf;
+// os_printf is buffered, see uart_init()
+int (*console_printf)(const char *fmt, ...) = os_printf;
 
 // Debug output.
-#ifdef DHT22_DEBUG
-#undef DHT22_DEBUG
+// DHT22_TRACE takes integer arguments only and is logged in binary
+// when BLOG_ENABLE is set, see driver/blog.h
+#define LOG_MODULE_LEVEL LOG_LEVEL_MAIN
+#include "log.h"
+#if LOG_ENABLED(LOG_DEBUG)
 #define DHT22_DEBUG(...) console_printf(__VA_ARGS__);
+#define DHT22_TRACE(...) BLOG(__VA_ARGS__);
 #else
 #define DHT22_DEBUG(...)
+#define DHT22_TRACE(...)
 #endif
 
 /////////////////////////////////////////////////////////////////
@@ -72,9 +82,17 @@ static ETSTimer WiFiLinker;
 static ETSTimer sleep_timer;
 LOCAL void ICACHE_FLASH_ATTR sleep_cb(void *arg)
 {
-DHT22_DEBUG("sleep_cb start.\n");
+DHT22_TRACE("sleep_cb start.\n");
 
     os_timer_disarm(&sleep_timer);
+    PROF_BEGIN(PROF_SLEEP);
+    if (uart_tx_dropped())
+        DHT22_TRACE("uart: %d log chars dropped\n", uart_tx_dropped());
+    uart_tx_flush();
+    PROF_END(PROF_SLEEP);
+    PROF_END(PROF_WAKE);
+    prof_save();
+    prof_dump();
     system_deep_sleep_set_option( 1 );
     system_deep_sleep(DATA_SEND_DELAY);//second*1000*1000
 }
@@ -95,27 +113,31 @@ LOCAL void ICACHE_FLASH_ATTR thingspeak_http_callback(char * response, int http_
 	}
 }
 
+static struct dht_acq_result dht_result;
+static BOOL dht_done = 0;
+
 LOCAL void ICACHE_FLASH_ATTR dht22_func()
 {
 	static char data[256];
 	static char temp[10];
 	static char hum[10];
-	struct dht_sensor_data* r;
-	float lastTemp, lastHum;
-    int iter = 10; // loop 
+	struct dht_acq_stats *q = &dht_result.stats;
+	int len;
+	int t = dht_result.temperature < 0 ? -dht_result.temperature : dht_result.temperature;
 
-    r = DHTRead();
-    lastTemp = r->temperature;
-    lastHum = r->humidity;
     unsigned int vdd = readvdd33();
-    if(r->success)
+    if(dht_result.success)
     {
-        os_sprintf(temp, "%d.%d",(int)(lastTemp),(int)((lastTemp - (int)lastTemp)*100));
-        os_sprintf(hum, "%d.%d",(int)(lastHum),(int)((lastHum - (int)lastHum)*100));
+        os_sprintf(temp, "%s%d.%d", dht_result.temperature < 0 ? "-" : "", t / 10, t % 10);
+        os_sprintf(hum, "%d.%d", dht_result.humidity / 10, dht_result.humidity % 10);
 DHT22_DEBUG("Temperature: %s *C, Humidity: %s %%\r\n", temp, hum);
 
         // Start the connection process
-        os_sprintf(data, "http://%s/update?key=%s&field4=%s&field2=%s&field6=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, temp, hum, vdd);
+        len = os_sprintf(data, "http://%s/update?key=%s&field4=%s&field2=%s&field6=%d&status=dht:%d/%d/%d/%d/%d/%d",
+        		THINGSPEAK_SERVER, THINGSPEAK_API_KEY, temp, hum, vdd,
+        		q->attempts, q->good, q->timeouts, q->bad_frames, q->checksum_errors, q->outliers);
+        // phase times of the previous wake
+        prof_last_status(data + len, ",");
 DHT22_DEBUG("Request: %s\r\n", data);
 
         http_get(data, "", thingspeak_http_callback);
@@ -123,24 +145,45 @@ DHT22_DEBUG("Request: %s\r\n", data);
     }
 }
 
+LOCAL void ICACHE_FLASH_ATTR dht22_acq_cb(struct dht_acq_result *result)
+{
+	PROF_END(PROF_DHT_READ);
+DHT22_TRACE("DHT22 acquisition: success %d, %d of %d reads good\r\n", result->success, result->stats.good, result->stats.attempts);
+
+	dht_result = *result;
+	dht_done = 1;
+	if (!dht_result.success)
+	{
+		// every retry already ran, waiting for the next wake is cheaper
+		os_timer_disarm(&WiFiLinker);
+		os_timer_disarm(&sleep_timer);
+		os_timer_setfn(&sleep_timer, sleep_cb, NULL);
+		os_timer_arm(&sleep_timer, 500, 1);
+		return;
+	}
+	if (wifi_station_get_connect_status() == STATION_GOT_IP)
+		dht22_func();
+}
+
 static void ICACHE_FLASH_ATTR wifi_check_ip(void *arg)
 {
-DHT22_DEBUG("wifi_check_ip\r\n");
+DHT22_TRACE("wifi_check_ip\r\n");
 
 	os_timer_disarm(&WiFiLinker);
     if (wifi_station_get_connect_status()==STATION_GOT_IP)
     {
-DHT22_DEBUG("WiFi connected, has IP...\r\n");
+DHT22_TRACE("WiFi connected, has IP...\r\n");
 
         wifi_get_ip_info(STATION_IF, &ipConfig);
         if(ipConfig.ip.addr != 0) 
         {
-DHT22_DEBUG("WiFi connected, IP is not empty - wait for DHT22...\r\n");
+DHT22_TRACE("WiFi connected, IP is not empty - wait for DHT22...\r\n");
 
-            dht22_func();
+            if (dht_done)
+                dht22_func();
         }
     }
-DHT22_DEBUG("WiFi connected, wait DHT22 timer...\r\n");
+DHT22_TRACE("WiFi connected, wait DHT22 timer...\r\n");
 
 	os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_check_ip, NULL);
 	os_timer_arm(&WiFiLinker, WIFI_CHECK_DELAY, 0);
@@ -174,12 +217,16 @@ void user_rf_pre_init(void)
 
 void user_init(void)
 {
+	prof_init();
+	PROF_BEGIN(PROF_WAKE);
+	PROF_BEGIN(PROF_WIFI_ASSOC);
+
 	// Configure the UART
 	uart_init(BIT_RATE_115200, BIT_RATE_115200);
 
 	system_set_os_print(1);
 	os_delay_us(10000);
-	DHT22_DEBUG("System init...\r\n");
+	DHT22_TRACE("System init...\r\n");
 
 
 //	os_delay_us(10000);
@@ -195,11 +242,14 @@ void user_init(void)
 
 	// Init DHT22 sensor
 	DHTInit(DHT22);
+	// Sample while Wi-Fi associates
+	PROF_BEGIN(PROF_DHT_READ);
+	DHTAcquire(dht22_acq_cb);
 
 	// Wait for Wi-Fi connection
 	os_timer_disarm(&WiFiLinker);
 	os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_check_ip, NULL);
 	os_timer_arm(&WiFiLinker, WIFI_CHECK_DELAY, 0);
 
-DHT22_DEBUG("System init done.\n");
+DHT22_TRACE("System init done.\n");
 }
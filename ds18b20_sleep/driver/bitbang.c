@@ -0,0 +1,19 @@
+/*
+    Timing helpers for the bit-banged sensor buses
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "driver/bitbang.h"
+
+uint32 bb_ticks_per_us = 80;
+uint32 bb_overruns = 0;
+
+//
+// Pick up the CPU clock, the drivers call this from their init
+//
+void ICACHE_FLASH_ATTR bb_init(void)
+{
+	bb_ticks_per_us = system_get_cpu_freq();
+}
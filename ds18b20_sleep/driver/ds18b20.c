@@ -19,6 +19,7 @@
 #include "espconn.h"
 #include "gpio.h"
 #include "driver/ds18b20.h"
+#include "driver/bitbang.h"
 
 // global search state
 static unsigned char address[8];
@@ -26,6 +27,28 @@ static uint8_t LastDiscrepancy;
 static uint8_t LastFamilyDiscrepancy;
 static uint8_t LastDeviceFlag;
 
+// ROM table kept in RTC memory across deep sleep
+struct ds_rom_cache {
+	uint32_t magic;
+	uint16_t generation;	// wakes since the bus was searched
+	uint8_t count;
+	uint8_t crc;		// crc8 over roms
+	uint8_t roms[DS_MAX_SENSORS][8];
+};
+
+// multi-bus state, bus i is on GPIO ds_bus_pins[i]
+static uint8_t ds_bus_pins[DS_MAX_BUSES];
+static uint8_t ds_bus_count;
+static uint32_t ds_bus_mask;
+
+// conversion state
+static ETSTimer ds_timer;
+static ds_convert_callback ds_convert_cb;
+static uint16_t ds_poll_left;
+static enum ds_resolution ds_res = DS_RESOLUTION_12;
+
+static const uint16_t ds_conv_time[4] = { 94, 188, 375, DS1820_CONVERSION_TIME };
+
 void ICACHE_FLASH_ATTR ds_init()
 {
 	// Set DS18B20_PIN as gpio pin
@@ -35,10 +58,217 @@ void ICACHE_FLASH_ATTR ds_init()
 	// Set DS18B20_PIN pin as an input
 	GPIO_DIS_OUTPUT(DS18B20_PIN);
 	reset_search();
+	bb_init();
+}
+
+//
+// Worst case conversion time in ms at the resolution last written
+//
+uint16_t ICACHE_FLASH_ATTR ds_conversion_time(void)
+{
+	return ds_conv_time[(ds_res >> 5) & 3];
+}
+
+//
+// Write the alarm thresholds and the resolution to one sensor, or to every
+// sensor when rom is NULL. With copy set they are also stored in EEPROM,
+// which takes 10 ms and wears the cell, so only do that on changes.
+//
+int ICACHE_FLASH_ATTR ds_write_config(const uint8_t *rom, int8_t th, int8_t tl, enum ds_resolution res, int copy)
+{
+	if (!reset())
+		return 0;
+	if (rom)
+		select(rom);
+	else
+		skip();
+	write(DS1820_WRITE_SCRATCHPAD, 0);
+	write((uint8_t)th, 0);
+	write((uint8_t)tl, 0);
+	write(res, 0);
+	ds_res = res;
+
+	if (copy) {
+		if (!reset())
+			return 0;
+		if (rom)
+			select(rom);
+		else
+			skip();
+		write(DS1820_COPY_SCRATCHPAD, 1);
+		os_delay_us(DS1820_COPY_TIME * 1000);
+		GPIO_DIS_OUTPUT(DS18B20_PIN);
+	}
+	return 1;
+}
+
+LOCAL void ICACHE_FLASH_ATTR ds_convert_poll(void *arg)
+{
+	os_timer_disarm(&ds_timer);
+	// the sensor answers read-slots with 0 until the conversion is done
+	if (read_bit()) {
+		ds_convert_cb(1);
+		return;
+	}
+	if (--ds_poll_left == 0) {
+		ds_convert_cb(0);
+		return;
+	}
+	os_timer_arm(&ds_timer, DS_POLL_INTERVAL, 0);
+}
+
+LOCAL void ICACHE_FLASH_ATTR ds_convert_wait(void *arg)
+{
+	os_timer_disarm(&ds_timer);
+	ds_convert_cb(1);
+}
+
+//
+// Start a temperature conversion on one sensor, or on every sensor when
+// rom is NULL. Returns 0 if nothing answered the reset; otherwise cb is
+// called from timer context once the conversion has finished.
+//
+int ICACHE_FLASH_ATTR ds_convert(const uint8_t *rom, enum ds_wait_mode mode, ds_convert_callback cb)
+{
+	if (!reset())
+		return 0;
+	if (rom)
+		select(rom);
+	else
+		skip();
+
+	ds_convert_cb = cb;
+	os_timer_disarm(&ds_timer);
+	if (mode == DS_WAIT_POLL) {
+		write(DS1820_CONVERT_T, 0);
+		ds_poll_left = ds_conversion_time() / DS_POLL_INTERVAL + 2;
+		os_timer_setfn(&ds_timer, (os_timer_func_t *)ds_convert_poll, NULL);
+		os_timer_arm(&ds_timer, DS_POLL_INTERVAL, 0);
+	} else {
+		// parasite powered sensors draw from the bus while converting
+		write(DS1820_CONVERT_T, 1);
+		os_timer_setfn(&ds_timer, (os_timer_func_t *)ds_convert_wait, NULL);
+		os_timer_arm(&ds_timer, ds_conversion_time(), 0);
+	}
+	return 1;
+}
+
+LOCAL int ICACHE_FLASH_ATTR ds_search_cmd(uint8_t *newAddr, uint8_t cmd);
+
+LOCAL uint8_t ICACHE_FLASH_ATTR ds_enumerate_cmd(uint8_t (*roms)[8], uint8_t max, uint8_t cmd)
+{
+	uint8_t count = 0;
+
+	reset_search();
+	while (count < max && ds_search_cmd(roms[count], cmd)) {
+		if (roms[count][0] == DS18B20_FAMILY && crc8(roms[count], 7) == roms[count][7])
+			count++;
+	}
+	reset_search();
+	return count;
+}
+
+//
+// Walk the bus and store up to max DS18B20 ROM codes. Returns the number
+// found; devices of other families or with a bad ROM CRC are skipped.
+//
+uint8_t ICACHE_FLASH_ATTR ds_enumerate(uint8_t (*roms)[8], uint8_t max)
+{
+	return ds_enumerate_cmd(roms, max, DS1820_SEARCHROM);
+}
+
+//
+// Like ds_enumerate(), but only sensors whose last conversion fell on
+// or outside their TH/TL band answer the alarm search.
+//
+uint8_t ICACHE_FLASH_ATTR ds_enumerate_alarms(uint8_t (*roms)[8], uint8_t max)
+{
+	return ds_enumerate_cmd(roms, max, DS1820_ALARMSEARCH);
+}
+
+//
+// Fetch the ROM table saved by ds_rom_cache_store() and count this wake
+// against it. Returns 0 when the bus has to be searched: cold boot, a
+// damaged cache, or DS_ROM_RESCAN_WAKES wakes since the last search.
+//
+uint8_t ICACHE_FLASH_ATTR ds_rom_cache_load(uint8_t (*roms)[8], uint8_t max)
+{
+	struct ds_rom_cache cache;
+
+	system_rtc_mem_read(DS_ROM_CACHE_RTC_BLOCK, &cache, sizeof(cache));
+	if (cache.magic != DS_ROM_CACHE_MAGIC
+			|| cache.count == 0 || cache.count > DS_MAX_SENSORS || cache.count > max
+			|| crc8(&cache.roms[0][0], sizeof(cache.roms)) != cache.crc
+			|| cache.generation >= DS_ROM_RESCAN_WAKES)
+		return 0;
+
+	cache.generation++;
+	system_rtc_mem_write(DS_ROM_CACHE_RTC_BLOCK, &cache, sizeof(cache));
+	os_memcpy(roms, cache.roms, cache.count * 8);
+	return cache.count;
+}
+
+void ICACHE_FLASH_ATTR ds_rom_cache_store(uint8_t (*roms)[8], uint8_t count)
+{
+	struct ds_rom_cache cache;
+
+	os_memset(&cache, 0, sizeof(cache));
+	cache.magic = DS_ROM_CACHE_MAGIC;
+	cache.count = count > DS_MAX_SENSORS ? DS_MAX_SENSORS : count;
+	os_memcpy(cache.roms, roms, cache.count * 8);
+	cache.crc = crc8(&cache.roms[0][0], sizeof(cache.roms));
+	system_rtc_mem_write(DS_ROM_CACHE_RTC_BLOCK, &cache, sizeof(cache));
+}
+
+//
+// Force a bus search on the next load, e.g. after a missing presence
+// pulse or a bad CRC from a cached ROM
+//
+void ICACHE_FLASH_ATTR ds_rom_cache_invalidate(void)
+{
+	uint32_t magic = 0;
+
+	system_rtc_mem_write(DS_ROM_CACHE_RTC_BLOCK, &magic, sizeof(magic));
+}
+
+//
+// Read the 9 scratchpad bytes of one sensor, or of the only sensor on
+// the bus when rom is NULL. Byte 8 is the CRC of the other eight; the
+// read is repeated on a mismatch and 0 returned if it never matched or
+// no sensor answered.
+//
+int ICACHE_FLASH_ATTR ds_read_scratchpad(const uint8_t *rom, uint8_t *data)
+{
+	int i, tries;
+
+	for (tries = 0; tries < DS_READ_RETRIES; tries++) {
+		if (!reset())
+			return 0;
+		if (rom)
+			select(rom);
+		else
+			skip();
+		write(DS1820_READ_SCRATCHPAD, 0);
+		for (i = 0; i < 9; i++)
+			data[i] = read();
+		if (crc8(data, 8) == data[8])
+			return 1;
+	}
+	return 0;
 }
 
 /* pass array of 8 bytes in */
 int ICACHE_FLASH_ATTR ds_search(uint8_t *newAddr)
+{
+	return ds_search_cmd(newAddr, DS1820_SEARCHROM);
+}
+
+int ICACHE_FLASH_ATTR ds_alarm_search(uint8_t *newAddr)
+{
+	return ds_search_cmd(newAddr, DS1820_ALARMSEARCH);
+}
+
+LOCAL int ICACHE_FLASH_ATTR ds_search_cmd(uint8_t *newAddr, uint8_t cmd)
 {
 	uint8_t id_bit_number;
 	uint8_t last_zero, rom_byte_number;
@@ -69,7 +299,7 @@ int ICACHE_FLASH_ATTR ds_search(uint8_t *newAddr)
 		}
 
 		// issue the search command
-		write(DS1820_SEARCHROM, 0);
+		write(cmd, 0);
 
 		// loop to do the search
 		do
@@ -193,21 +423,26 @@ void ICACHE_FLASH_ATTR reset_search()
 // the bus to come high, if it doesn't then it is broken or shorted
 // and we return a 0;
 // Returns 1 if a device asserted a presence pulse, 0 otherwise.
-uint8_t ICACHE_FLASH_ATTR reset(void)
+// The slot routines below stay in IRAM, see bitbang.h.
+uint8_t reset(void)
 {
 	int r;
+	uint32_t start;
 	uint8_t retries = 125;
 	GPIO_DIS_OUTPUT(DS18B20_PIN);
 	do {
 		if (--retries == 0) return 0;
-		os_delay_us(2);
+		bb_delay_us(2);
 	} while ( !GPIO_INPUT_GET(DS18B20_PIN));
 	GPIO_OUTPUT_SET(DS18B20_PIN, 0);
-	os_delay_us(500);
+	bb_delay_us(500);
+	BB_LOCK();
+	start = bb_ccount();
 	GPIO_DIS_OUTPUT(DS18B20_PIN);
-	os_delay_us(65);
+	bb_wait_until(start, 65);
 	r = !GPIO_INPUT_GET(DS18B20_PIN);
-	os_delay_us(490);
+	BB_UNLOCK();
+	bb_delay_us(490);
 	return r;
 }
 
@@ -225,8 +460,9 @@ void ICACHE_FLASH_ATTR write(uint8_t v, int power)
 		write_bit((bitMask & v)?1:0);
 	}
 	if (!power) {
+		// release the bus to the pull-up; driving it low here would
+		// look like a reset pulse to a sensor that is converting
 		GPIO_DIS_OUTPUT(DS18B20_PIN);
-		GPIO_OUTPUT_SET(DS18B20_PIN, 0);
 	}
 }
 
@@ -234,18 +470,22 @@ void ICACHE_FLASH_ATTR write(uint8_t v, int power)
 // Write a bit. Port and bit is used to cut lookup time and provide
 // more certain timing.
 //
-void ICACHE_FLASH_ATTR write_bit(int v)
+void write_bit(int v)
 {
+	uint32_t start;
+	BB_LOCK();
+	start = bb_ccount();
 	GPIO_OUTPUT_SET(DS18B20_PIN, 0);
 	if(v) {
-		os_delay_us(10);
+		bb_wait_until(start, 10);
 		GPIO_OUTPUT_SET(DS18B20_PIN, 1);
-		os_delay_us(55);
+		bb_wait_until(start, 65);
 	} else {
-		os_delay_us(65);
+		bb_wait_until(start, 65);
 		GPIO_OUTPUT_SET(DS18B20_PIN, 1);
-		os_delay_us(5);
+		bb_wait_until(start, 70);
 	}
+	BB_UNLOCK();
 }
 
 //
@@ -265,56 +505,239 @@ uint8_t ICACHE_FLASH_ATTR read()
 // Read a bit. Port and bit is used to cut lookup time and provide
 // more certain timing.
 //
-int ICACHE_FLASH_ATTR read_bit(void)
+int read_bit(void)
 {
 	int r;
+	uint32_t start;
+	BB_LOCK();
+	start = bb_ccount();
 	GPIO_OUTPUT_SET(DS18B20_PIN, 0);
-	os_delay_us(3);
+	bb_wait_until(start, 3);
 	GPIO_DIS_OUTPUT(DS18B20_PIN);
-	os_delay_us(10);
+	// the sensor's bit is only valid until 15 us into the slot
+	bb_wait_until(start, 13);
 	r = GPIO_INPUT_GET(DS18B20_PIN);
-	os_delay_us(53);
+	BB_UNLOCK();
+	bb_delay_us(53);
 	return r;
 }
 
 //
-// Compute a Dallas Semiconductor 8 bit CRC directly.
-// this is much slower, but much smaller, than the lookup table.
+// Multi-bus mode: several 1-Wire buses, one sensor each, on different
+// GPIOs. Every slot is driven on all of them with one set/clear mask and
+// every bus is sampled from the same input register read, so reading N
+// cables costs the bus time of one.
 //
-uint8_t ICACHE_FLASH_ATTR crc8(const uint8_t *addr, uint8_t len)
+
+LOCAL uint32_t ICACHE_FLASH_ATTR ds_multi_to_bus(uint32_t gpio)
+{
+	uint32_t bus = 0;
+	uint8_t i;
+	for (i = 0; i < ds_bus_count; i++)
+		if (gpio & (1 << ds_bus_pins[i]))
+			bus |= 1 << i;
+	return bus;
+}
+
+int ICACHE_FLASH_ATTR ds_multi_init(const uint8_t *pins, uint8_t count)
 {
-	uint8_t crc = 0;
 	uint8_t i;
-	while (len--) {
-		uint8_t inbyte = *addr++;
-		for (i = 8; i; i--) {
-			uint8_t mix = (crc ^ inbyte) & 0x01;
-			crc >>= 1;
-			if (mix) crc ^= 0x8C;
-			inbyte >>= 1;
+
+	if (count > DS_MAX_BUSES)
+		return 0;
+	ds_bus_count = count;
+	ds_bus_mask = 0;
+	for (i = 0; i < count; i++) {
+		switch (pins[i]) {
+		case 0: PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO0_U, FUNC_GPIO0); PIN_PULLUP_EN(PERIPHS_IO_MUX_GPIO0_U); break;
+		case 2: PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO2_U, FUNC_GPIO2); PIN_PULLUP_EN(PERIPHS_IO_MUX_GPIO2_U); break;
+		case 4: PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO4_U, FUNC_GPIO4); PIN_PULLUP_EN(PERIPHS_IO_MUX_GPIO4_U); break;
+		case 5: PIN_FUNC_SELECT(PERIPHS_IO_MUX_GPIO5_U, FUNC_GPIO5); PIN_PULLUP_EN(PERIPHS_IO_MUX_GPIO5_U); break;
+		case 12: PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDI_U, FUNC_GPIO12); PIN_PULLUP_EN(PERIPHS_IO_MUX_MTDI_U); break;
+		case 13: PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, FUNC_GPIO13); PIN_PULLUP_EN(PERIPHS_IO_MUX_MTCK_U); break;
+		case 14: PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTMS_U, FUNC_GPIO14); PIN_PULLUP_EN(PERIPHS_IO_MUX_MTMS_U); break;
+		case 15: PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, FUNC_GPIO15); break; // needs an external pull-up
+		default: return 0;
 		}
+		ds_bus_pins[i] = pins[i];
+		ds_bus_mask |= 1 << pins[i];
 	}
-	return crc;
+	gpio_output_set(0, 0, 0, ds_bus_mask);
+	bb_init();
+	return 1;
+}
+
+//
+// Reset every bus. Returns a mask with bit i set if bus i answered with
+// a presence pulse.
+//
+uint32_t ds_multi_reset(void)
+{
+	uint32_t r, start;
+	uint8_t retries = 125;
+	gpio_output_set(0, 0, 0, ds_bus_mask);
+	// a bus that never comes up is shorted and simply reports no presence
+	while ((gpio_input_get() & ds_bus_mask) != ds_bus_mask && --retries)
+		bb_delay_us(2);
+	gpio_output_set(0, ds_bus_mask, ds_bus_mask, 0);
+	bb_delay_us(500);
+	BB_LOCK();
+	start = bb_ccount();
+	gpio_output_set(0, 0, 0, ds_bus_mask);
+	bb_wait_until(start, 65);
+	r = ~gpio_input_get() & ds_bus_mask;
+	BB_UNLOCK();
+	bb_delay_us(490);
+	return ds_multi_to_bus(r);
+}
+
+//
+// Write one bit per bus in a single slot: buses writing 1 are released
+// after 10 us, buses writing 0 after 65 us.
+//
+LOCAL void ds_multi_write_bits(uint32_t ones)
+{
+	uint32_t zeros = ds_bus_mask & ~ones;
+	uint32_t start;
+	BB_LOCK();
+	start = bb_ccount();
+	gpio_output_set(0, ds_bus_mask, ds_bus_mask, 0);
+	bb_wait_until(start, 10);
+	gpio_output_set(ones, 0, ones, 0);
+	bb_wait_until(start, 65);
+	gpio_output_set(zeros, 0, zeros, 0);
+	bb_wait_until(start, 70);
+	BB_UNLOCK();
+}
+
+//
+// One read slot on every bus, returns the GPIO input register
+//
+LOCAL uint32_t ds_multi_read_bits(void)
+{
+	uint32_t in, start;
+	BB_LOCK();
+	start = bb_ccount();
+	gpio_output_set(0, ds_bus_mask, ds_bus_mask, 0);
+	bb_wait_until(start, 3);
+	gpio_output_set(0, 0, 0, ds_bus_mask);
+	bb_wait_until(start, 13);
+	in = gpio_input_get();
+	BB_UNLOCK();
+	bb_delay_us(53);
+	return in;
 }
 
 //
-// Compute a Dallas Semiconductor 16 bit CRC. I have never seen one of
-// these, but here it is.
+// Write byte v[i] to bus i
 //
-uint16_t ICACHE_FLASH_ATTR crc16(const uint16_t *data, const uint16_t  len)
+void ICACHE_FLASH_ATTR ds_multi_write(const uint8_t *v, int power)
 {
-	uint16_t  i;
-	uint16_t  crc = 0;
-    for ( i = 0; i < len; i++) {
-    	uint16_t cdata = data[len];
-    	cdata = (cdata ^ (crc & 0xff)) & 0xff;
-    	crc >>= 8;
-    	if (oddparity[cdata & 0xf] ^ oddparity[cdata >> 4])
-    		crc ^= 0xc001;
-    	cdata <<= 6;
-    	crc ^= cdata;
-    	cdata <<= 1;
-    	crc ^= cdata;
-    }
-    return crc;
+	uint8_t bitMask, i;
+	uint32_t ones;
+	for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+		ones = 0;
+		for (i = 0; i < ds_bus_count; i++)
+			if (v[i] & bitMask)
+				ones |= 1 << ds_bus_pins[i];
+		ds_multi_write_bits(ones);
+	}
+	if (!power)
+		gpio_output_set(0, 0, 0, ds_bus_mask);
+}
+
+//
+// Write the same byte to every bus
+//
+void ICACHE_FLASH_ATTR ds_multi_write_all(uint8_t v, int power)
+{
+	uint8_t bitMask;
+	for (bitMask = 0x01; bitMask; bitMask <<= 1)
+		ds_multi_write_bits((bitMask & v) ? ds_bus_mask : 0);
+	if (!power)
+		gpio_output_set(0, 0, 0, ds_bus_mask);
+}
+
+//
+// Read one byte from every bus into v[i]
+//
+void ICACHE_FLASH_ATTR ds_multi_read(uint8_t *v)
+{
+	uint8_t bitMask, i;
+	uint32_t in;
+	for (i = 0; i < ds_bus_count; i++)
+		v[i] = 0;
+	for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+		in = ds_multi_read_bits();
+		for (i = 0; i < ds_bus_count; i++)
+			if (in & (1 << ds_bus_pins[i]))
+				v[i] |= bitMask;
+	}
+}
+
+//
+// ds_write_config() for every bus, without the EEPROM copy
+//
+uint32_t ICACHE_FLASH_ATTR ds_multi_write_config(int8_t th, int8_t tl, enum ds_resolution res)
+{
+	uint32_t present = ds_multi_reset();
+	if (!present)
+		return 0;
+	ds_multi_write_all(DS1820_SKIP_ROM, 0);
+	ds_multi_write_all(DS1820_WRITE_SCRATCHPAD, 0);
+	ds_multi_write_all((uint8_t)th, 0);
+	ds_multi_write_all((uint8_t)tl, 0);
+	ds_multi_write_all(res, 0);
+	ds_res = res;
+	return present;
+}
+
+//
+// Start a conversion on every bus. The buses stay driven high for
+// parasite power and cb runs after the conversion time; returns the mask
+// of buses that answered the reset, 0 meaning cb will not be called.
+//
+uint32_t ICACHE_FLASH_ATTR ds_multi_convert(ds_convert_callback cb)
+{
+	uint32_t present = ds_multi_reset();
+	if (!present)
+		return 0;
+	ds_multi_write_all(DS1820_SKIP_ROM, 0);
+	ds_multi_write_all(DS1820_CONVERT_T, 1);
+
+	ds_convert_cb = cb;
+	os_timer_disarm(&ds_timer);
+	os_timer_setfn(&ds_timer, (os_timer_func_t *)ds_convert_wait, NULL);
+	os_timer_arm(&ds_timer, ds_conversion_time(), 0);
+	return present;
+}
+
+//
+// Read the scratchpad of the sensor on every bus into data[i]. Returns
+// the mask of buses whose scratchpad passed the CRC check.
+//
+uint32_t ICACHE_FLASH_ATTR ds_multi_read_scratchpad(uint8_t (*data)[9])
+{
+	uint8_t byte[DS_MAX_BUSES];
+	uint32_t ok = 0;
+	int i, tries;
+	uint8_t bus;
+
+	for (tries = 0; tries < DS_READ_RETRIES; tries++) {
+		uint32_t want = ds_multi_reset() & ~ok;
+		if (!want)
+			break;
+		ds_multi_write_all(DS1820_SKIP_ROM, 0);
+		ds_multi_write_all(DS1820_READ_SCRATCHPAD, 0);
+		for (i = 0; i < 9; i++) {
+			ds_multi_read(byte);
+			for (bus = 0; bus < ds_bus_count; bus++)
+				if (want & (1 << bus))
+					data[bus][i] = byte[bus];
+		}
+		for (bus = 0; bus < ds_bus_count; bus++)
+			if ((want & (1 << bus)) && crc8(data[bus], 8) == data[bus][8])
+				ok |= 1 << bus;
+	}
+	return ok;
 }
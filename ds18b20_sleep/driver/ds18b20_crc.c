@@ -0,0 +1,58 @@
+/*
+    1-Wire CRCs for the DS18B20 driver, kept apart from the bus code so
+    that tools/crc_check.c can build them on the host
+*/
+
+#include "driver/ds18b20.h"
+
+//
+// CRC lookup tables, one entry per nibble. The CRC is linear, so the
+// table value of a byte is the XOR of the values of its two nibbles.
+// At 16 entries each the tables stay in DRAM, which spares the aligned
+// 32-bit accesses a table in flash would need.
+//
+static const uint8_t crc8_lo[16] = {
+	0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83,
+	0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41
+};
+static const uint8_t crc8_hi[16] = {
+	0x00, 0x9D, 0x23, 0xBE, 0x46, 0xDB, 0x65, 0xF8,
+	0x8C, 0x11, 0xAF, 0x32, 0xCA, 0x57, 0xE9, 0x74
+};
+static const uint16_t crc16_lo[16] = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440
+};
+static const uint16_t crc16_hi[16] = {
+	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+
+//
+// Compute a Dallas Semiconductor 8 bit CRC (x^8 + x^5 + x^4 + 1), as
+// used by ROM codes and the scratchpad.
+//
+uint8_t ICACHE_FLASH_ATTR crc8(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+	while (len--) {
+		crc ^= *addr++;
+		crc = crc8_lo[crc & 0x0f] ^ crc8_hi[crc >> 4];
+	}
+	return crc;
+}
+
+//
+// Compute a Dallas Semiconductor 16 bit CRC (x^16 + x^15 + x^2 + 1), as
+// used by the DS2450 and EEPROM devices. The bus sends it inverted.
+//
+uint16_t ICACHE_FLASH_ATTR crc16(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0;
+	uint8_t idx;
+	while (len--) {
+		idx = (crc ^ *data++) & 0xff;
+		crc = (crc >> 8) ^ crc16_lo[idx & 0x0f] ^ crc16_hi[idx >> 4];
+	}
+	return crc;
+}
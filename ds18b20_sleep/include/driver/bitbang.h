@@ -0,0 +1,57 @@
+/*
+    Timing helpers for the bit-banged sensor buses
+
+    Bit-level routines that use these must not be ICACHE_FLASH_ATTR, so
+    the linker keeps them in IRAM and a flash cache miss cannot stretch a
+    slot. Slots that are timed by the host are run between BB_LOCK() and
+    BB_UNLOCK() so Wi-Fi interrupts cannot stretch them either.
+*/
+
+#ifndef __BITBANG_H__
+#define __BITBANG_H__
+
+#include "ets_sys.h"
+#include "c_types.h"
+
+#define BB_SLACK_US	2	// lateness past a deadline counted as an overrun
+
+#define BB_LOCK()	ets_intr_lock()
+#define BB_UNLOCK()	ets_intr_unlock()
+
+extern uint32 bb_ticks_per_us;	// CPU clock in MHz
+extern uint32 bb_overruns;	// slot deadlines missed by more than BB_SLACK_US
+
+void bb_init(void);
+
+static inline uint32 __attribute__((always_inline)) bb_ccount(void)
+{
+	uint32 r;
+	__asm__ __volatile__("rsr %0, ccount" : "=a"(r));
+	return r;
+}
+
+// Busy-wait for a number of CPU cycles
+static inline void __attribute__((always_inline)) bb_delay_ticks(uint32 ticks)
+{
+	uint32 start = bb_ccount();
+	while (bb_ccount() - start < ticks)
+		;
+}
+
+// Busy-wait on the cycle counter, replaces os_delay_us() in slots
+static inline void __attribute__((always_inline)) bb_delay_us(uint32 us)
+{
+	bb_delay_ticks(us * bb_ticks_per_us);
+}
+
+// Wait until us microseconds after start, a CCOUNT taken at slot begin
+static inline void __attribute__((always_inline)) bb_wait_until(uint32 start, uint32 us)
+{
+	uint32 ticks = us * bb_ticks_per_us;
+	if (bb_ccount() - start > ticks + BB_SLACK_US * bb_ticks_per_us)
+		bb_overruns++;
+	while (bb_ccount() - start < ticks)
+		;
+}
+
+#endif
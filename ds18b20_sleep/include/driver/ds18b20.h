@@ -21,19 +21,67 @@
 #define DS1820_ALARMSEARCH 		0xEC
 #define DS1820_CONVERT_T		0x44
 
-static uint16_t oddparity[16] = {0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0};
+#define DS_MAX_BUSES			4	// 1-Wire buses driven in lockstep
+
+#define DS18B20_FAMILY			0x28
+#define DS_MAX_SENSORS			7	// ThingSpeak has 8 fields, one is Vdd
+
+#define DS_ROM_CACHE_RTC_BLOCK		64	// first RTC user memory block (4 bytes each)
+#define DS_ROM_CACHE_MAGIC		0x31575230
+#define DS_ROM_RESCAN_WAKES		144	// search the bus again after this many wakes
+
+#define DS1820_CONVERSION_TIME		750	// ms, 12-bit resolution
+#define DS1820_COPY_TIME		10	// ms, EEPROM write
+#define DS_POLL_INTERVAL		10	// ms between completion read-slots
+#define DS_READ_RETRIES			3	// scratchpad reads before giving up on a CRC
+
+// Configuration register values, resolution is in bits 5-6
+enum ds_resolution {
+	DS_RESOLUTION_9 = 0x1F,		// 0.5 *C, 94 ms
+	DS_RESOLUTION_10 = 0x3F,	// 0.25 *C, 188 ms
+	DS_RESOLUTION_11 = 0x5F,	// 0.125 *C, 375 ms
+	DS_RESOLUTION_12 = 0x7F		// 0.0625 *C, 750 ms
+};
+
+// Bits of the raw temperature that are undefined at a given resolution
+#define DS_RESOLUTION_MASK(res)	((uint16_t)~((1 << (3 - (((res) >> 5) & 3))) - 1))
+
+enum ds_wait_mode {
+	DS_WAIT_POLL,	// release the bus and poll read-slots, external power only
+	DS_WAIT_TIMER	// hold the bus high for the full conversion time
+};
+
+typedef void (*ds_convert_callback)(int success);
 
 void ds_init();
+int ds_convert(const uint8_t *rom, enum ds_wait_mode mode, ds_convert_callback cb);
+int ds_write_config(const uint8_t *rom, int8_t th, int8_t tl, enum ds_resolution res, int copy);
+uint16_t ds_conversion_time(void);
+uint8_t ds_enumerate(uint8_t (*roms)[8], uint8_t max);
+uint8_t ds_enumerate_alarms(uint8_t (*roms)[8], uint8_t max);
+int ds_read_scratchpad(const uint8_t *rom, uint8_t *data);
+uint8_t ds_rom_cache_load(uint8_t (*roms)[8], uint8_t max);
+void ds_rom_cache_store(uint8_t (*roms)[8], uint8_t count);
+void ds_rom_cache_invalidate(void);
 int ds_search(uint8_t *addr);
+int ds_alarm_search(uint8_t *addr);
 void select(const uint8_t rom[8]);
 void skip();
 void reset_search();
 uint8_t reset(void);
+int ds_multi_init(const uint8_t *pins, uint8_t count);
+uint32_t ds_multi_reset(void);
+void ds_multi_write(const uint8_t *v, int power);
+void ds_multi_write_all(uint8_t v, int power);
+void ds_multi_read(uint8_t *v);
+uint32_t ds_multi_write_config(int8_t th, int8_t tl, enum ds_resolution res);
+uint32_t ds_multi_convert(ds_convert_callback cb);
+uint32_t ds_multi_read_scratchpad(uint8_t (*data)[9]);
 void write(uint8_t v, int power);
 void write_bit(int v);
 uint8_t read();
 int read_bit(void);
 uint8_t crc8(const uint8_t *addr, uint8_t len);
-uint16_t crc16(const uint16_t *data, const uint16_t  len);
+uint16_t crc16(const uint8_t *data, uint16_t len);
 
 #endif
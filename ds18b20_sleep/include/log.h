@@ -0,0 +1,70 @@
+/*
+    Compile-time log levels
+
+    A module defines LOG_MODULE_LEVEL, usually as its LOG_LEVEL_<MODULE>
+    from user_config.h, before including this header. LOG_E/W/I/D calls
+    above that level, or above LOG_LEVEL_MAX, expand to nothing: neither
+    the call nor its format string reaches the firmware. Build with
+    LOG_LEVEL_MAX set to LOG_NONE for a release, "make logsize" shows what
+    logging costs at the current levels.
+
+    LOG_PRINTF may be defined first to send a module's messages elsewhere,
+    e.g. to BLOG or ets_uart_printf.
+*/
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include "osapi.h"
+#include "user_config.h"
+
+#define LOG_NONE	0
+#define LOG_ERROR	1
+#define LOG_WARN	2
+#define LOG_INFO	3
+#define LOG_DEBUG	4
+
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX	LOG_DEBUG
+#endif
+
+#ifndef LOG_MODULE_LEVEL
+#define LOG_MODULE_LEVEL	LOG_LEVEL_MAX
+#endif
+
+#ifndef LOG_PRINTF
+#define LOG_PRINTF	os_printf
+#endif
+
+// usable in #if, for messages that need more than one printf
+#if LOG_MODULE_LEVEL > LOG_LEVEL_MAX
+#define LOG_ENABLED(level)	(LOG_LEVEL_MAX >= (level))
+#else
+#define LOG_ENABLED(level)	(LOG_MODULE_LEVEL >= (level))
+#endif
+
+#if LOG_ENABLED(LOG_ERROR)
+#define LOG_E(...)	LOG_PRINTF(__VA_ARGS__)
+#else
+#define LOG_E(...)	do {} while (0)
+#endif
+
+#if LOG_ENABLED(LOG_WARN)
+#define LOG_W(...)	LOG_PRINTF(__VA_ARGS__)
+#else
+#define LOG_W(...)	do {} while (0)
+#endif
+
+#if LOG_ENABLED(LOG_INFO)
+#define LOG_I(...)	LOG_PRINTF(__VA_ARGS__)
+#else
+#define LOG_I(...)	do {} while (0)
+#endif
+
+#if LOG_ENABLED(LOG_DEBUG)
+#define LOG_D(...)	LOG_PRINTF(__VA_ARGS__)
+#else
+#define LOG_D(...)	do {} while (0)
+#endif
+
+#endif
@@ -1,8 +1,19 @@
 #ifndef _USER_CONFIG_H_
 #define _USER_CONFIG_H_
 
-#define HTTP_DEBUG	false
-#define DHT22_DEBUG	false
+// Log level per module: LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO or
+// LOG_DEBUG, see log.h. Messages above it are compiled out.
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		LOG_DEBUG	// LOG_NONE for a release build
+#endif
+#define LOG_LEVEL_HTTP		LOG_ERROR
+
+// Time the wake cycle with CCOUNT probes and print them before sleeping,
+// convert the log with tools/prof_trace.py
+//#define PROF_ENABLE
+// Keep each wake's phase times in RTC memory (7 blocks) and upload them
+// with the next reading, see driver/prof.h
+#define PROF_RTC_BLOCK		82	// after the alarm state at 80..81
 
 #define WIFI_CLIENTSSID		"BONOBO"
 #define WIFI_CLIENTPASSWORD	"FFFFEEEE00"
@@ -10,6 +21,27 @@
 #define DATA_SEND_DELAY 600*1000	/* milliseconds */
 #define WIFI_CHECK_DELAY 4000	/* milliseconds */
 
+// DS_WAIT_TIMER works with parasite power, DS_WAIT_POLL needs a Vdd wire
+#define DS18B20_WAIT_MODE	DS_WAIT_TIMER
+// 9 bit (0.5 *C) converts in 94 ms instead of 750 ms at 12 bit
+#define DS18B20_RESOLUTION	DS_RESOLUTION_9
+// Conversions attempted per wake; after that the upload goes without
+// temperatures and a ds18b20:error status, and the node sleeps
+#define DS18B20_READ_RETRIES	3
+#define DS18B20_ALARM_HIGH	125	/* *C */
+#define DS18B20_ALARM_LOW	-55	/* *C */
+// ThingSpeak field per sensor, in bus search order; field3 carries Vdd
+#define DS18B20_FIELDS		{ 1, 2, 4, 5, 6, 7, 8 }
+// Report only sensors outside DS18B20_ALARM_LOW..HIGH, found with the alarm
+// search; in-band wakes sleep again with the radio off. Every
+// DS18B20_ALARM_HEARTBEAT wakes all sensors are reported, status "heartbeat".
+//#define DS18B20_ALARM_MODE
+#define DS18B20_ALARM_HEARTBEAT	144
+#define DS18B20_ALARM_RTC_BLOCK	80	/* after the ROM cache at 64..79 */
+// One sensor per cable on these GPIOs, read in lockstep (at most 4).
+// Leave undefined for a single bus on DS18B20_PIN.
+//#define DS18B20_BUS_PINS	{ 2, 4, 5 }
+
 // Thingspeak server address
 #define THINGSPEAK_SERVER	"184.106.153.149"
 //#define THINGSPEAK_SERVER	"api.thingspeak.com"
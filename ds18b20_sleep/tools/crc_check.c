@@ -0,0 +1,121 @@
+/*
+    Host check of driver/ds18b20_crc.c. Fails unless crc8() and crc16()
+    give the known check values and agree with the bitwise loops they
+    replaced on random buffers. Also prints the host time per byte of
+    the nibble tables against those loops.
+
+    cc -O2 -I include -o crc_check tools/crc_check.c
+    ./crc_check
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// stand in for the SDK headers, driver/ds18b20.h is skipped
+#define __DS18B20_H__
+#define ICACHE_FLASH_ATTR
+uint8_t crc8(const uint8_t *addr, uint8_t len);
+uint16_t crc16(const uint8_t *data, uint16_t len);
+
+#include "../driver/ds18b20_crc.c"
+
+#define BUF_LEN	255
+#define ROUNDS	20000
+
+static int failed;
+
+// The bit at a time CRC the driver used before the tables
+static uint8_t crc8_bitwise(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0, i, inbyte, mix;
+	while (len--) {
+		inbyte = *addr++;
+		for (i = 8; i; i--) {
+			mix = (crc ^ inbyte) & 0x01;
+			crc >>= 1;
+			if (mix)
+				crc ^= 0x8C;
+			inbyte >>= 1;
+		}
+	}
+	return crc;
+}
+
+// x^16 + x^15 + x^2 + 1, reflected, as crc16() computes it
+static uint16_t crc16_bitwise(const uint8_t *data, uint16_t len)
+{
+	uint16_t crc = 0;
+	uint8_t i;
+	while (len--) {
+		crc ^= *data++;
+		for (i = 8; i; i--)
+			crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+static void expect(const char *what, unsigned got, unsigned want)
+{
+	printf("%-28s %04x (want %04x)%s\n", what, got, want, got != want ? " FAIL" : "");
+	if (got != want)
+		failed = 1;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void)
+{
+	static const uint8_t rom[7] = { 0x28, 0xFF, 0x78, 0x01, 0x01, 0x15, 0x03 };
+	static const uint8_t check[9] = "123456789";
+	uint8_t buf[BUF_LEN];
+	volatile unsigned sink = 0;
+	double t0, t8, t8_bit, t16, t16_bit;
+	int i, j, len, mismatch = 0;
+
+	expect("crc8 ROM 28ff7801011503", crc8(rom, sizeof(rom)), 0xCE);
+	expect("crc8 \"123456789\"", crc8(check, sizeof(check)), 0xA1);
+	expect("crc16 \"123456789\"", crc16(check, sizeof(check)), 0xBB3D);
+
+	srand(1);
+	for (i = 0; i < ROUNDS; i++) {
+		len = rand() % (BUF_LEN + 1);
+		for (j = 0; j < len; j++)
+			buf[j] = rand();
+		if (crc8(buf, len) != crc8_bitwise(buf, len) || crc16(buf, len) != crc16_bitwise(buf, len))
+			mismatch++;
+	}
+	printf("%-28s %d of %d%s\n", "random buffers differing", mismatch, ROUNDS, mismatch ? " FAIL" : "");
+	if (mismatch)
+		failed = 1;
+
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink += crc8(buf, BUF_LEN - (i & 1));
+	t8 = now_ns() - t0;
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink += crc8_bitwise(buf, BUF_LEN - (i & 1));
+	t8_bit = now_ns() - t0;
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink += crc16(buf, BUF_LEN - (i & 1));
+	t16 = now_ns() - t0;
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink += crc16_bitwise(buf, BUF_LEN - (i & 1));
+	t16_bit = now_ns() - t0;
+	(void)sink;
+
+	printf("host ns/byte: crc8 %.2f, bitwise %.2f; crc16 %.2f, bitwise %.2f\n",
+			t8 / ROUNDS / BUF_LEN, t8_bit / ROUNDS / BUF_LEN,
+			t16 / ROUNDS / BUF_LEN, t16_bit / ROUNDS / BUF_LEN);
+	return failed;
+}
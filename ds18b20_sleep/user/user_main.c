@@ -6,6 +6,8 @@
 #include "httpclient.h"
 #include "user_config.h"
 #include "driver/ds18b20.h"
+#include "driver/bitbang.h"
+#include "driver/prof.h"
 
 typedef enum {
 	WIFI_CONNECTING,
@@ -26,11 +28,39 @@ static ETSTimer WiFiLinker;
 
 int ds18b20();
 
+#ifdef DS18B20_ALARM_MODE
+#ifdef DS18B20_BUS_PINS
+#error "DS18B20_ALARM_MODE needs a single bus"
+#endif
+
+// Alarm mode state, kept in RTC memory across deep sleep
+struct ds_alarm_rtc {
+	uint32_t magic;
+	uint16_t quiet_wakes;	// wakes since the last report
+	uint8_t report;		// next wake has the radio on to report
+	uint8_t pad;
+};
+
+#define DS_ALARM_RTC_MAGIC	0x414c524d
+#define DS_ALARM_RADIO_WAKE	10000	/* us, reboot with RF on to report */
+#define DS_ALARM_GIVE_UP	2000	/* ms, sleep if the bus never answers */
+#define DS18B20_SLEEP_OPTION	4	/* wake with the radio off */
+
+static struct ds_alarm_rtc ds_alarm;
+static int ds_radio_on;
+static int ds_heartbeat;	// this wake reports for DS18B20_ALARM_HEARTBEAT
+#else
+#define DS18B20_SLEEP_OPTION	1
+#endif
+
 static ETSTimer sleep_timer;
 LOCAL void ICACHE_FLASH_ATTR sleep_cb(void *arg)
 {
     os_timer_disarm(&sleep_timer);
-    system_deep_sleep_set_option( 1 );
+    PROF_END(PROF_WAKE);
+    prof_save();
+    prof_dump();
+    system_deep_sleep_set_option( DS18B20_SLEEP_OPTION );
     system_deep_sleep(DATA_SEND_DELAY*1000);//second*1000*1000
 }
 
@@ -83,57 +113,241 @@ void user_rf_pre_init(void)
 {
 }
 
-int ICACHE_FLASH_ATTR ds18b20()
-{
-	int r, i;
-	uint8_t data[12];
-	uint8_t addr[] = "\x28\xff\x78\x01\x01\x15\x03\xce";
-
-	ds_init();
-	reset();
-
-	select(addr);
-	write(DS1820_CONVERT_T, 1); // perform temperature conversion
+static uint8_t ds_roms[DS_MAX_SENSORS][8];
+static uint8_t ds_count = 0;
+static char temp[DS_MAX_SENSORS][10];
+static uint32_t ds_valid = 0;	// sensors with a reading in temp[]
+static int ds_ready = 0;
+static int ds_busy = 0;
+static int ds_attempts = 0;	// conversions started this wake
 
-	os_delay_us(1000*1000); // sleep 1s
-
-	reset();
-
-	select(addr);
-	write(DS1820_READ_SCRATCHPAD, 0); // read scratchpad
-	
-	for(i = 0; i < 9; i++)
-	{
-		data[i] = read();
-	}
-
-	int HighByte, LowByte, TReading, SignBit, Tc_100, Whole, Fract;
+LOCAL void ICACHE_FLASH_ATTR ds18b20_format(char *buf, const uint8_t *data)
+{
+	int HighByte, LowByte, TReading, SignBit, Whole, Fract;
 	LowByte = data[0];
 	HighByte = data[1];
-	TReading = (HighByte << 8) + LowByte;
+	TReading = ((HighByte << 8) + LowByte) & DS_RESOLUTION_MASK(DS18B20_RESOLUTION);
 	SignBit = TReading & 0x8000;  // test most sig bit
 	if (SignBit) // negative
 		TReading = (TReading ^ 0xffff) + 1; // 2's comp
 	
 	Whole = TReading >> 4;  // separate off the whole and fractional portions
 	Fract = (TReading & 0xf) * 100 / 16;
-    
+
+    os_sprintf(buf, "%d.%d", Whole, Fract < 10 ? 0 : Fract);
+}
+
+#ifdef DS18B20_BUS_PINS
+static const uint8_t ds_bus_pins[] = DS18B20_BUS_PINS;
+
+LOCAL void ICACHE_FLASH_ATTR ds18b20_converted(int success);
+
+LOCAL void ICACHE_FLASH_ATTR ds18b20_start(void)
+{
+	// one sensor per bus, all buses convert in lockstep
+	PROF_BEGIN(PROF_DS18B20);
+	ds_attempts++;
+	ds_count = sizeof(ds_bus_pins);
+	ds_busy = ds_multi_convert(ds18b20_converted) != 0;
+}
+
+LOCAL void ICACHE_FLASH_ATTR ds18b20_converted(int success)
+{
+	uint8_t data[DS_MAX_BUSES][9];
+	uint8_t i;
+
+	PROF_END(PROF_DS18B20);
+	ds_busy = 0;
+	if (!success)
+		return;
+
+	ds_valid = ds_multi_read_scratchpad(data);
+	if (!ds_valid)
+		return;
+	for (i = 0; i < ds_count; i++)
+		if (ds_valid & (1 << i))
+			ds18b20_format(temp[i], data[i]);
+    ds_ready = 1;
+
+    // Wi-Fi may have come up while the sensors were converting
+    if (wifi_station_get_connect_status() == STATION_GOT_IP)
+        ds18b20();
+}
+#else
+LOCAL void ICACHE_FLASH_ATTR ds18b20_converted(int success);
+
+// The bus changed under the cached ROM table, search it on the next try
+LOCAL void ICACHE_FLASH_ATTR ds18b20_rescan(void)
+{
+	ds_rom_cache_invalidate();
+	ds_count = 0;
+}
+
+#ifdef DS18B20_ALARM_MODE
+// Mask of the sensors in ds_roms that answer the alarm search
+LOCAL uint32_t ICACHE_FLASH_ATTR ds18b20_alarm_mask(void)
+{
+	uint8_t alarms[DS_MAX_SENSORS][8];
+	uint8_t n, i, j;
+	uint32_t mask = 0;
+
+	n = ds_enumerate_alarms(alarms, DS_MAX_SENSORS);
+	for (i = 0; i < n; i++)
+		for (j = 0; j < ds_count; j++)
+			if (os_memcmp(alarms[i], ds_roms[j], 8) == 0)
+				mask |= 1 << j;
+	return mask;
+}
+
+// Decide whether this wake reports. Returns 0 once deep sleep is entered.
+LOCAL int ICACHE_FLASH_ATTR ds18b20_alarm_check(uint32_t alarm)
+{
+	if (!alarm && ds_alarm.quiet_wakes < DS18B20_ALARM_HEARTBEAT)
+	{
+		// every sensor is in band, sleep again without Wi-Fi
+		ds_alarm.quiet_wakes++;
+		system_rtc_mem_write(DS18B20_ALARM_RTC_BLOCK, &ds_alarm, sizeof(ds_alarm));
+		PROF_END(PROF_WAKE);
+		prof_save();
+		prof_dump();
+		system_deep_sleep_set_option(4);
+		system_deep_sleep(DATA_SEND_DELAY*1000);
+		return 0;
+	}
+	if (!ds_radio_on)
+	{
+		ds_alarm.report = 1;
+		system_rtc_mem_write(DS18B20_ALARM_RTC_BLOCK, &ds_alarm, sizeof(ds_alarm));
+		PROF_END(PROF_WAKE);
+		prof_save();
+		prof_dump();
+		system_deep_sleep_set_option(1);
+		system_deep_sleep(DS_ALARM_RADIO_WAKE);
+		return 0;
+	}
+	ds_alarm.quiet_wakes = 0;
+	system_rtc_mem_write(DS18B20_ALARM_RTC_BLOCK, &ds_alarm, sizeof(ds_alarm));
+	return 1;
+}
+#endif
+
+LOCAL void ICACHE_FLASH_ATTR ds18b20_start(void)
+{
+	ds_attempts++;
+	if (ds_count == 0)
+		ds_count = ds_rom_cache_load(ds_roms, DS_MAX_SENSORS);
+	if (ds_count == 0)
+	{
+		ds_count = ds_enumerate(ds_roms, DS_MAX_SENSORS);
+		if (ds_count == 0)
+			return;
+		ds_rom_cache_store(ds_roms, ds_count);
+	}
+	// one broadcast, every sensor converts in parallel
+	PROF_BEGIN(PROF_DS18B20);
+	ds_busy = ds_convert(NULL, DS18B20_WAIT_MODE, ds18b20_converted);
+	if (!ds_busy)
+		ds18b20_rescan();
+}
+
+LOCAL void ICACHE_FLASH_ATTR ds18b20_converted(int success)
+{
+	uint8_t i;
+	uint8_t data[12];
+	uint32_t wanted = (1 << ds_count) - 1;
+
+	PROF_END(PROF_DS18B20);
+	ds_busy = 0;
+	if (!success)
+	{
+		ds18b20_rescan();
+		return;
+	}
+
+#ifdef DS18B20_ALARM_MODE
+	// only sensors outside their band are read and reported, except on a
+	// heartbeat, which shows that every probe still reads
+	wanted = ds18b20_alarm_mask();
+	ds_heartbeat = ds_alarm.quiet_wakes >= DS18B20_ALARM_HEARTBEAT;
+	if (!ds18b20_alarm_check(wanted))
+		return;
+	if (ds_heartbeat)
+		wanted = (1 << ds_count) - 1;
+#endif
+
+	for (i = 0; i < ds_count; i++)
+	{
+		if (!(wanted & (1 << i)))
+			continue;
+		if (!ds_read_scratchpad(ds_roms[i], data))
+		{
+			ds18b20_rescan();
+			return;
+		}
+		ds18b20_format(temp[i], data);
+	}
+    ds_valid = wanted;
+    ds_ready = 1;
+
+    // Wi-Fi may have come up while the sensors were converting
+    if (wifi_station_get_connect_status() == STATION_GOT_IP)
+        ds18b20();
+}
+#endif
+
+int ICACHE_FLASH_ATTR ds18b20()
+{
+    if (!ds_ready) {
+        if (ds_busy)
+            return 0;
+        // retry a conversion that failed to start or finish; a dead or
+        // unplugged probe must not keep the node awake on Wi-Fi
+        if (ds_attempts < DS18B20_READ_RETRIES) {
+            ds18b20_start();
+            return 0;
+        }
+    }
+
     unsigned int vdd = readvdd33();
 
     wifi_get_ip_info(STATION_IF, &ipConfig);
-    static char temp[10];
     static char http_data[256];
+    static const uint8_t fields[DS_MAX_SENSORS] = DS18B20_FIELDS;
+    const char *sep = "&status=";
+    int len;
+    uint8_t i;
 
-    os_sprintf(temp, "%d.%d", Whole, Fract < 10 ? 0 : Fract);
     // Start the connection process
-    os_sprintf(http_data, "http://%s/update?key=%s&field1=%s&field3=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, temp, vdd);
+    len = os_sprintf(http_data, "http://%s/update?key=%s&field3=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, vdd);
+    for (i = 0; i < ds_count; i++)
+        if (ds_valid & (1 << i))
+            len += os_sprintf(http_data + len, "&field%d=%s", fields[i], temp[i]);
+    if (!ds_ready) {
+        len += os_sprintf(http_data + len, "%sds18b20:error", sep);
+        sep = ",";
+    }
+#ifdef DS18B20_ALARM_MODE
+    if (ds_heartbeat) {
+        len += os_sprintf(http_data + len, "%sheartbeat", sep);
+        sep = ",";
+    }
+#endif
+    // 1-Wire slots that ran late this wake, see bitbang.h
+    if (bb_overruns) {
+        len += os_sprintf(http_data + len, "%sbb:%d", sep, bb_overruns);
+        sep = ",";
+    }
+    // phase times of the previous wake
+    prof_last_status(http_data + len, sep);
     http_get(http_data, "", thingspeak_http_callback);
 
-    return r;
+    return 1;
 }
 
 void user_init(void)
 {
+    prof_init();
+    PROF_BEGIN(PROF_WAKE);
     system_set_os_print(0);
 
 	if(wifi_get_opmode() != STATION_MODE)
@@ -145,7 +359,39 @@ void user_init(void)
 	if(wifi_station_get_auto_connect() == 0)
 		wifi_station_set_auto_connect(1);
 
+	// Convert while Wi-Fi associates
+#ifdef DS18B20_BUS_PINS
+	ds_multi_init(ds_bus_pins, sizeof(ds_bus_pins));
+	ds_multi_write_config(DS18B20_ALARM_HIGH, DS18B20_ALARM_LOW, DS18B20_RESOLUTION);
+#else
+	ds_init();
+	ds_write_config(NULL, DS18B20_ALARM_HIGH, DS18B20_ALARM_LOW, DS18B20_RESOLUTION, 0);
+#endif
+#ifdef DS18B20_ALARM_MODE
+	system_rtc_mem_read(DS18B20_ALARM_RTC_BLOCK, &ds_alarm, sizeof(ds_alarm));
+	if (ds_alarm.magic != DS_ALARM_RTC_MAGIC)
+	{
+		os_memset(&ds_alarm, 0, sizeof(ds_alarm));
+		ds_alarm.magic = DS_ALARM_RTC_MAGIC;
+	}
+	ds_radio_on = system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE || ds_alarm.report;
+	ds_alarm.report = 0;
+#endif
+	ds18b20_start();
+
+#ifdef DS18B20_ALARM_MODE
+	if (!ds_radio_on)
+	{
+		// ds18b20_alarm_check() sleeps long before this fires
+		os_timer_disarm(&sleep_timer);
+		os_timer_setfn(&sleep_timer, sleep_cb, NULL);
+		os_timer_arm(&sleep_timer, DS_ALARM_GIVE_UP, 0);
+		return;
+	}
+#endif
+
 	// Wait for Wi-Fi connection
+	PROF_BEGIN(PROF_WIFI_ASSOC);
 	os_timer_disarm(&WiFiLinker);
 	os_timer_setfn(&WiFiLinker, (os_timer_func_t *)wifi_check_ip, NULL);
 	os_timer_arm(&WiFiLinker, WIFI_CHECK_DELAY, 0);
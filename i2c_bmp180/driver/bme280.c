@@ -0,0 +1,219 @@
+/*
+    BMP280 / BME280 driver for the I2C sensor registry
+
+    Compensation follows the integer reference code of the Bosch
+    datasheets: 32 bit temperature and humidity, 64 bit pressure.
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "driver/i2c.h"
+#include "driver/i2c_sensor.h"
+#include "driver/bme280.h"
+
+// lives in struct i2c_sensor.priv
+struct bme280 {
+	uint16 T1;
+	sint16 T2, T3;
+	uint16 P1;
+	sint16 P2, P3, P4, P5, P6, P7, P8, P9;
+	sint16 H2, H4, H5;
+	uint8 H1, H3;
+	sint8 H6;
+	uint8 humidity;		// 1 on the BME280
+	uint8 polls;		// status reads since start()
+	sint32 t_fine;
+};
+
+#define LE16(b, i)	((uint16)((b)[(i) + 1] << 8 | (b)[i]))
+
+LOCAL bool ICACHE_FLASH_ATTR
+bme280_probe_id(struct i2c_sensor *dev, uint8 chip_id)
+{
+	struct bme280 *c = (struct bme280 *)dev->priv;
+	uint8 id, b[24];
+
+	if (i2c_read_regs(dev->addr, BME280_CHIP_ID_REG, &id, 1) != I2C_OK || id != chip_id)
+		return 0;
+
+	if (i2c_read_regs(dev->addr, BME280_CAL_TP_REG, b, 24) != I2C_OK)
+		return 0;
+	c->T1 = LE16(b, 0);
+	c->T2 = LE16(b, 2);
+	c->T3 = LE16(b, 4);
+	c->P1 = LE16(b, 6);
+	c->P2 = LE16(b, 8);
+	c->P3 = LE16(b, 10);
+	c->P4 = LE16(b, 12);
+	c->P5 = LE16(b, 14);
+	c->P6 = LE16(b, 16);
+	c->P7 = LE16(b, 18);
+	c->P8 = LE16(b, 20);
+	c->P9 = LE16(b, 22);
+
+	c->humidity = chip_id == BME280_CHIP_ID;
+	if (c->humidity) {
+		if (i2c_read_regs(dev->addr, BME280_CAL_H1_REG, &c->H1, 1) != I2C_OK
+				|| i2c_read_regs(dev->addr, BME280_CAL_H2_REG, b, 7) != I2C_OK)
+			return 0;
+		c->H2 = LE16(b, 0);
+		c->H3 = b[2];
+		c->H4 = ((sint16)(sint8)b[3] << 4) | (b[4] & 0x0F);
+		c->H5 = ((sint16)(sint8)b[5] << 4) | (b[4] >> 4);
+		c->H6 = (sint8)b[6];
+	}
+	return 1;
+}
+
+LOCAL bool ICACHE_FLASH_ATTR
+bmp280_probe(struct i2c_sensor *dev)
+{
+	return bme280_probe_id(dev, BMP280_CHIP_ID);
+}
+
+LOCAL bool ICACHE_FLASH_ATTR
+bme280_probe(struct i2c_sensor *dev)
+{
+	return bme280_probe_id(dev, BME280_CHIP_ID);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+bme280_started(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+	struct bme280 *c = (struct bme280 *)dev->priv;
+
+	if (txn->status != I2C_OK)
+		i2c_sensor_done(dev, txn->status);
+	else
+		i2c_sensor_done(dev, c->humidity ? BME280_MEAS_TIME : BMP280_MEAS_TIME);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR
+bme280_start(struct i2c_sensor *dev)
+{
+	struct bme280 *c = (struct bme280 *)dev->priv;
+	uint8 len = 0;
+
+	c->polls = 0;
+	// one write of register and value pairs; ctrl_hum only takes effect
+	// with the following ctrl_meas write
+	if (c->humidity) {
+		dev->tx[len++] = BME280_CTRL_HUM_REG;
+		dev->tx[len++] = BME280_OSRS_H;
+	}
+	dev->tx[len++] = BME280_CTRL_MEAS_REG;
+	dev->tx[len++] = BME280_CTRL_MEAS;
+	i2c_txn_write(&dev->txn, dev->addr, dev->tx, len);
+	return i2c_queue_submit(&dev->txn, bme280_started, dev);
+}
+
+// 0.01 *C, also sets t_fine for the other two
+LOCAL sint32 ICACHE_FLASH_ATTR
+bme280_temperature(struct bme280 *c, sint32 adc_T)
+{
+	sint32 var1, var2;
+
+	var1 = ((((adc_T >> 3) - ((sint32)c->T1 << 1))) * ((sint32)c->T2)) >> 11;
+	var2 = (((((adc_T >> 4) - ((sint32)c->T1)) * ((adc_T >> 4) - ((sint32)c->T1))) >> 12) * ((sint32)c->T3)) >> 14;
+	c->t_fine = var1 + var2;
+	return (c->t_fine * 5 + 128) >> 8;
+}
+
+// Pa in Q24.8
+LOCAL uint32 ICACHE_FLASH_ATTR
+bme280_pressure(struct bme280 *c, sint32 adc_P)
+{
+	sint64 var1, var2, p;
+
+	var1 = ((sint64)c->t_fine) - 128000;
+	var2 = var1 * var1 * (sint64)c->P6;
+	var2 = var2 + ((var1 * (sint64)c->P5) << 17);
+	var2 = var2 + (((sint64)c->P4) << 35);
+	var1 = ((var1 * var1 * (sint64)c->P3) >> 8) + ((var1 * (sint64)c->P2) << 12);
+	var1 = (((((sint64)1) << 47) + var1)) * ((sint64)c->P1) >> 33;
+	if (var1 == 0)
+		return 0;
+	p = 1048576 - adc_P;
+	p = (((p << 31) - var2) * 3125) / var1;
+	var1 = (((sint64)c->P9) * (p >> 13) * (p >> 13)) >> 25;
+	var2 = (((sint64)c->P8) * p) >> 19;
+	p = ((p + var1 + var2) >> 8) + (((sint64)c->P7) << 4);
+	return (uint32)p;
+}
+
+// %RH in Q22.10
+LOCAL uint32 ICACHE_FLASH_ATTR
+bme280_humidity(struct bme280 *c, sint32 adc_H)
+{
+	sint32 v;
+
+	v = c->t_fine - ((sint32)76800);
+	v = (((((adc_H << 14) - (((sint32)c->H4) << 20) - (((sint32)c->H5) * v)) + ((sint32)16384)) >> 15)
+		* (((((((v * ((sint32)c->H6)) >> 10) * (((v * ((sint32)c->H3)) >> 11) + ((sint32)32768))) >> 10)
+		+ ((sint32)2097152)) * ((sint32)c->H2) + 8192) >> 14));
+	v = (v - (((((v >> 15) * (v >> 15)) >> 7) * ((sint32)c->H1)) >> 4));
+	v = v < 0 ? 0 : v;
+	v = v > 419430400 ? 419430400 : v;
+	return (uint32)(v >> 12);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+bme280_fetched(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+	struct bme280 *c = (struct bme280 *)dev->priv;
+	struct i2c_sensor_reading *r = dev->reading;
+	// status, then the data from BME280_DATA_REG on
+	const uint8 *b = dev->rx + BME280_DATA_REG - BME280_STATUS_REG;
+
+	if (txn->status != I2C_OK) {
+		i2c_sensor_done(dev, txn->status);
+		return;
+	}
+	if (dev->rx[0] & BME280_STATUS_MEASURING) {
+		i2c_sensor_done(dev, ++c->polls < BME280_MAX_POLLS ? 1 : I2C_ERR_TIMEOUT);
+		return;
+	}
+
+	r->temperature = bme280_temperature(c, ((sint32)b[3] << 12) | (b[4] << 4) | (b[5] >> 4));
+	r->pressure = (bme280_pressure(c, ((sint32)b[0] << 12) | (b[1] << 4) | (b[2] >> 4)) + 128) >> 8;
+	r->valid = I2C_SENSOR_TEMPERATURE | I2C_SENSOR_PRESSURE;
+	if (c->humidity) {
+		r->humidity = (bme280_humidity(c, (b[6] << 8) | b[7]) * 100 + 512) >> 10;
+		r->valid |= I2C_SENSOR_HUMIDITY;
+	}
+	i2c_sensor_done(dev, 0);
+}
+
+//
+// Status and data in one burst; the data is only used once the status
+// shows the measurement has finished
+//
+LOCAL sint8 ICACHE_FLASH_ATTR
+bme280_read(struct i2c_sensor *dev)
+{
+	struct bme280 *c = (struct bme280 *)dev->priv;
+
+	dev->tx[0] = BME280_STATUS_REG;
+	i2c_txn_read_regs(&dev->txn, dev->addr, dev->tx, dev->rx,
+			BME280_DATA_REG - BME280_STATUS_REG + (c->humidity ? 8 : 6));
+	return i2c_queue_submit(&dev->txn, bme280_fetched, dev);
+}
+
+const struct i2c_sensor_driver bmp280_sensor = {
+	"BMP280",
+	{ BME280_ADDR_LOW, BME280_ADDR_HIGH },
+	bmp280_probe,
+	bme280_start,
+	bme280_read
+};
+
+const struct i2c_sensor_driver bme280_sensor = {
+	"BME280",
+	{ BME280_ADDR_LOW, BME280_ADDR_HIGH },
+	bme280_probe,
+	bme280_start,
+	bme280_read
+};
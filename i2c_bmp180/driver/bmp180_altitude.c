@@ -0,0 +1,83 @@
+/*
+    Barometric formula in fixed point, h = 44330 * (1 - (p / p0)^(1 / 5.255)).
+    Both directions interpolate linearly in a 65 entry Q24 table so that
+    no soft-float pow() is needed.
+
+    Kept apart from the I2C code in i2c_bmp180.c, tools/bmp180_altitude_check.c
+    builds this file on the host and checks it against the float formula.
+*/
+
+#include "driver/i2c_bmp180.h"
+
+// (0.25 + i / 64)^(1 / 5.255) in Q24, pressure ratios 0.25..1.25
+static const uint32_t bmp_ratio_root[65] = {
+	12886973, 13036505, 13179077, 13315372, 13445978, 13571399,
+	13692073, 13808385, 13920672, 14029232, 14134331, 14236206,
+	14335070, 14431116, 14524516, 14615429, 14703997, 14790352,
+	14874613, 14956891, 15037286, 15115894, 15192800, 15268083,
+	15341820, 15414079, 15484925, 15554418, 15622614, 15689567,
+	15755326, 15819937, 15883444, 15945889, 16007311, 16067746,
+	16127228, 16185792, 16243468, 16300285, 16356272, 16411455,
+	16465860, 16519510, 16572429, 16624639, 16676160, 16727013,
+	16777216, 16826788, 16875746, 16924108, 16971888, 17019103,
+	17065767, 17111894, 17157498, 17202592, 17247189, 17291300,
+	17334938, 17378113, 17420837, 17463119, 17504970
+};
+
+// (1 - (64 * i - 512) / 44330)^-5.255 in Q24, altitudes -512..3584 m
+static const uint32_t bmp_sea_level_factor[65] = {
+	15794720, 15913713, 16033774, 16154915, 16277147, 16400482,
+	16524930, 16650504, 16777216, 16905077, 17034100, 17164296,
+	17295679, 17428260, 17562053, 17697070, 17833325, 17970830,
+	18109599, 18249645, 18390982, 18533625, 18677585, 18822879,
+	18969521, 19117524, 19266903, 19417674, 19569852, 19723451,
+	19878487, 20034976, 20192934, 20352376, 20513319, 20675779,
+	20839773, 21005318, 21172430, 21341127, 21511426, 21683346,
+	21856903, 22032116, 22209004, 22387585, 22567878, 22749901,
+	22933675, 23119219, 23306552, 23495694, 23686667, 23879490,
+	24074184, 24270771, 24469271, 24669707, 24872100, 25076473,
+	25282847, 25491247, 25701694, 25914213, 26128826
+};
+
+//
+// Altitude in 0.1 m of a pressure reading against a sea level pressure,
+// both in Pa. Within 0.7 m of the float formula up to 3 km, 3 m to 10 km.
+//
+int32_t ICACHE_FLASH_ATTR BMP180_Altitude(int32_t pressure, int32_t sea_level)
+{
+	uint32_t r, i, frac;
+	int32_t f;
+
+	if (pressure <= 0 || sea_level <= 0)
+		return 0;
+	// p / p0 in Q20, clamped to the table
+	r = ((uint64_t)pressure << 20) / (uint32_t)sea_level;
+	if (r < (1 << 18))
+		r = 1 << 18;
+	else if (r >= (1 << 18) + (1 << 20))
+		r = (1 << 18) + (1 << 20) - 1;
+	r -= 1 << 18;
+	i = r >> 14;
+	frac = r & 0x3FFF;
+	f = bmp_ratio_root[i] + (((int32_t)(bmp_ratio_root[i + 1] - bmp_ratio_root[i]) * (int32_t)(frac >> 4)) >> 10);
+	return (int32_t)(((int64_t)443300 * ((1 << 24) - f) + (1 << 23)) >> 24);
+}
+
+//
+// Pressure in Pa reduced to sea level from a station at altitude, in
+// 0.1 m. Within 2.5 Pa of the float formula between -512 and 3584 m.
+//
+int32_t ICACHE_FLASH_ATTR BMP180_SeaLevelPressure(int32_t pressure, int32_t altitude)
+{
+	int32_t h = altitude + 5120;
+	uint32_t i, frac, g;
+
+	if (h < 0)
+		h = 0;
+	else if (h >= 64 * 640)
+		h = 64 * 640 - 1;
+	i = h / 640;
+	frac = h % 640;
+	g = bmp_sea_level_factor[i] + (bmp_sea_level_factor[i + 1] - bmp_sea_level_factor[i]) * frac / 640;
+	return (int32_t)(((int64_t)pressure * g + (1 << 23)) >> 24);
+}
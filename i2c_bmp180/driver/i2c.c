@@ -20,35 +20,83 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "gpio.h"
+#include "user_interface.h"
 #include "driver/i2c.h"
+#include "driver/bitbang.h"
+
+/*
+ * The bit level functions run from IRAM, see bitbang.h. The lines are
+ * open drain, so writing a 1 to W1TS releases the line to the pull-up
+ * and writing to W1TC pulls it low.
+ */
+
+#define SDA_HIGH()  GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, 1 << I2C_SDA_PIN)
+#define SDA_LOW()   GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, 1 << I2C_SDA_PIN)
+#define SCK_HIGH()  GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, 1 << I2C_SCK_PIN)
+#define SCK_LOW()   GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, 1 << I2C_SCK_PIN)
+#define SCK_READ()  ((GPIO_REG_READ(GPIO_IN_ADDRESS) >> I2C_SCK_PIN) & 1)
+
+// CPU cycles SCK is held low and high, set by i2c_set_speed()
+LOCAL uint32 i2c_low_ticks;
+LOCAL uint32 i2c_high_ticks;
+
+#define i2c_wait_low()  bb_delay_ticks(i2c_low_ticks)
+#define i2c_wait_high() bb_delay_ticks(i2c_high_ticks)
+
+// First error seen since the current transaction started
+LOCAL sint8 i2c_error;
+
+// Transaction queue, see i2c_queue_submit()
+LOCAL struct i2c_txn *i2c_queue_head;
+LOCAL struct i2c_txn *i2c_queue_tail;
+LOCAL uint8 i2c_queue_seg;
+LOCAL sint16 i2c_queue_pos;        // -1 until the segment's address is sent
+LOCAL bool i2c_queue_ready = 0;
+LOCAL os_event_t i2c_queue_events[I2C_QUEUE_EVENTS];
 
 /**
- * Set SDA to state
+ * Release SCK and wait until it actually reads high, so a slave can
+ * stretch the clock. Gives up after I2C_STRETCH_TIMEOUT us. Once the
+ * transaction has failed it does not wait at all, so a stuck SCK costs
+ * one timeout per transaction instead of one per bit.
  */
-LOCAL void ICACHE_FLASH_ATTR
-i2c_sda(uint8 state)
+static inline void
+i2c_sck_release(void)
 {
-    state &= 0x01;
-    //Set SDA line to state
-    if (state)
-        gpio_output_set(1 << I2C_SDA_PIN, 0, 1 << I2C_SDA_PIN, 0);
-    else
-        gpio_output_set(0, 1 << I2C_SDA_PIN, 1 << I2C_SDA_PIN, 0);
+    uint32 start = bb_ccount();
+    uint32 limit = I2C_STRETCH_TIMEOUT * bb_ticks_per_us;
+
+    SCK_HIGH();
+    if (i2c_error != I2C_OK)
+        return;
+    while (!SCK_READ()) {
+        if (bb_ccount() - start > limit) {
+            if (i2c_error == I2C_OK)
+                i2c_error = I2C_ERR_TIMEOUT;
+            return;
+        }
+    }
 }
 
 /**
- * Set SCK to state
+ * Set the SCK half periods for the given bus speed, calibrated against
+ * the current CPU clock
  */
-LOCAL void ICACHE_FLASH_ATTR
-i2c_sck(uint8 state)
+void ICACHE_FLASH_ATTR
+i2c_set_speed(enum I2C_SPEED speed)
 {
-    //Set SCK line to state
-    if (state)
-        gpio_output_set(1 << I2C_SCK_PIN, 0, 1 << I2C_SCK_PIN, 0);
-    else
-        gpio_output_set(0, 1 << I2C_SCK_PIN, 1 << I2C_SCK_PIN, 0);
+    if (speed == I2C_SPEED_400K) {
+        // tLOW >= 1.3 us, tHIGH >= 0.6 us; 1.3 + 1.2 us is 400 kHz
+        i2c_low_ticks = bb_ticks_per_us * 13 / 10;
+        i2c_high_ticks = bb_ticks_per_us * 12 / 10;
+    } else {
+        i2c_low_ticks = bb_ticks_per_us * 5;
+        i2c_high_ticks = bb_ticks_per_us * 5;
+    }
 }
 
+LOCAL void i2c_queue_run(os_event_t *event);
+
 /**
  * I2C init function
  * This sets up the GPIO io
@@ -84,37 +132,80 @@ i2c_init(void)
     //Turn interrupt back on
     ETS_GPIO_INTR_ENABLE();
 
-    i2c_sda(1);
-    i2c_sck(1);
+    if (!i2c_queue_ready) {
+        system_os_task(i2c_queue_run, I2C_QUEUE_TASK_PRIO, i2c_queue_events, I2C_QUEUE_EVENTS);
+        i2c_queue_ready = 1;
+    }
+
+    bb_init();
+    i2c_set_speed(I2C_DEFAULT_SPEED);
+    SDA_HIGH();
+    SCK_HIGH();
+    i2c_bus_recover();
     return;
 }
 
 /**
- * I2C Start signal 
+ * Free a bus held by a slave that lost sync mid-byte, e.g. after a
+ * brown-out: clock SCK up to nine times until SDA is released, then
+ * send a stop
+ * returns I2C_OK if both lines are high afterwards
  */
-void ICACHE_FLASH_ATTR
+sint8 ICACHE_FLASH_ATTR
+i2c_bus_recover(void)
+{
+    uint8 i;
+
+    i2c_error = I2C_OK;
+    SDA_HIGH();
+    for (i = 0; i < 9 && !i2c_read(); i++) {
+        SCK_LOW();
+        i2c_wait_low();
+        i2c_sck_release();
+        i2c_wait_high();
+    }
+    i2c_stop();
+
+    if (!i2c_read() || !SCK_READ())
+        return I2C_ERR_BUS;
+    i2c_error = I2C_OK;
+    return I2C_OK;
+}
+
+/**
+ * I2C Start signal, also used for a repeated start
+ * Leaves SCK low
+ */
+void
 i2c_start(void)
 {
-    i2c_sda(1);
-    i2c_sck(1);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sda(0);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
+    BB_LOCK();
+    SDA_HIGH();
+    i2c_sck_release();
+    i2c_wait_high();
+    if (!i2c_read() && i2c_error == I2C_OK)
+        i2c_error = I2C_ERR_BUS;
+    SDA_LOW();
+    i2c_wait_high();
+    SCK_LOW();
+    BB_UNLOCK();
 }
 
 /**
  * I2C Stop signal 
  */
-void ICACHE_FLASH_ATTR
+void
 i2c_stop(void)
 {
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(1);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sda(1);
-    os_delay_us(I2C_SLEEP_TIME);
+    BB_LOCK();
+    SCK_LOW();
+    SDA_LOW();
+    i2c_wait_low();
+    i2c_sck_release();
+    i2c_wait_high();
+    SDA_HIGH();
+    i2c_wait_high();
+    BB_UNLOCK();
 }
 
 /**
@@ -123,26 +214,26 @@ i2c_stop(void)
  *  1 for ACK
  *  0 for NACK
  */
-void ICACHE_FLASH_ATTR
+void
 i2c_send_ack(uint8 state)
 {
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
+    BB_LOCK();
     //Set SDA 
     //  HIGH for NACK
     //  LOW  for ACK
-    i2c_sda((state?0:1));
+    if (state)
+        SDA_LOW();
+    else
+        SDA_HIGH();
 
     //Pulse the SCK
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(1);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
+    i2c_wait_low();
+    i2c_sck_release();
+    i2c_wait_high();
+    SCK_LOW();
 
-    i2c_sda(1);
-    os_delay_us(I2C_SLEEP_TIME);
+    SDA_HIGH();
+    BB_UNLOCK();
 }
 
 /**
@@ -151,25 +242,22 @@ i2c_send_ack(uint8 state)
  *  1 for ACK
  *  0 for NACK
  */
-uint8 ICACHE_FLASH_ATTR
+uint8
 i2c_check_ack(void)
 {
     uint8 ack;
-    i2c_sda(1);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(1);
-    os_delay_us(I2C_SLEEP_TIME);
+
+    BB_LOCK();
+    SDA_HIGH();
+    i2c_wait_low();
+    i2c_sck_release();
+    i2c_wait_high();
 
     //Get SDA pin status
-    ack = i2c_read(); 
+    ack = i2c_read();
 
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
-    i2c_sda(0);
-    os_delay_us(I2C_SLEEP_TIME);
+    SCK_LOW();
+    BB_UNLOCK();
 
     return (ack?0:1);
 }
@@ -178,33 +266,25 @@ i2c_check_ack(void)
  * Receive byte from the I2C bus 
  * returns the byte 
  */
-uint8 ICACHE_FLASH_ATTR
+uint8
 i2c_readByte(void)
 {
     uint8 data = 0;
-    uint8 data_bit;
     uint8 i;
 
-    i2c_sda(1);
+    SDA_HIGH();
 
     for (i = 0; i < 8; i++)
     {
-        os_delay_us(I2C_SLEEP_TIME);
-        i2c_sck(0);
-        os_delay_us(I2C_SLEEP_TIME);
-
-        i2c_sck(1);
-        os_delay_us(I2C_SLEEP_TIME);
-
-        data_bit = i2c_read();
-        os_delay_us(I2C_SLEEP_TIME);
-
-        data_bit <<= (7 - i);
-        data |= data_bit;
+        BB_LOCK();
+        i2c_wait_low();
+        i2c_sck_release();
+        i2c_wait_high();
+        data = (data << 1) | i2c_read();
+        SCK_LOW();
+        BB_UNLOCK();
     }
-    i2c_sck(0);
-    os_delay_us(I2C_SLEEP_TIME);
-    
+
     return data;
 }
 
@@ -212,21 +292,309 @@ i2c_readByte(void)
  * Write byte to I2C bus
  * uint8 data: to byte to be writen
  */
-void ICACHE_FLASH_ATTR
+void
 i2c_writeByte(uint8 data)
 {
-    uint8 data_bit;
     sint8 i;
 
-    os_delay_us(I2C_SLEEP_TIME);
-
     for (i = 7; i >= 0; i--) {
-        data_bit = data >> i;
-        i2c_sda(data_bit);
-        os_delay_us(I2C_SLEEP_TIME);
-        i2c_sck(1);
-        os_delay_us(I2C_SLEEP_TIME);
-        i2c_sck(0);
-        os_delay_us(I2C_SLEEP_TIME);
+        BB_LOCK();
+        if ((data >> i) & 1)
+            SDA_HIGH();
+        else
+            SDA_LOW();
+        i2c_wait_low();
+        i2c_sck_release();
+        i2c_wait_high();
+        SCK_LOW();
+        BB_UNLOCK();
+    }
+}
+
+/**
+ * Send the address byte for dev (7 bit) and the r/w flag
+ * returns 1 if the device acknowledged
+ */
+LOCAL uint8 ICACHE_FLASH_ATTR
+i2c_address(uint8 dev, uint8 read)
+{
+    i2c_start();
+    i2c_writeByte((dev << 1) | (read ? 1 : 0));
+    return i2c_check_ack();
+}
+
+/**
+ * Address dev for writing and send the register pointer
+ * returns 1 if both bytes were acknowledged
+ */
+LOCAL uint8 ICACHE_FLASH_ATTR
+i2c_select(uint8 dev, uint8 reg)
+{
+    if (!i2c_address(dev, 0))
+        return 0;
+    i2c_writeByte(reg);
+    return i2c_check_ack();
+}
+
+/**
+ * End a transaction with a stop and turn its outcome into a status.
+ * A clock stretch timeout or a stuck bus also runs the bus recovery,
+ * so the next transaction starts from a clean state.
+ */
+LOCAL sint8 ICACHE_FLASH_ATTR
+i2c_finish(uint8 acked)
+{
+    sint8 status;
+
+    i2c_stop();
+    status = i2c_error;
+    if (status != I2C_OK) {
+        i2c_bus_recover();
+        return status;
+    }
+    return acked ? I2C_OK : I2C_ERR_NACK;
+}
+
+/**
+ * Read len registers starting at reg in a single transaction, relying on
+ * the device's register auto-increment. Every byte but the last is ACKed.
+ * returns I2C_OK or one of the I2C_ERR_* codes
+ */
+sint8 ICACHE_FLASH_ATTR
+i2c_read_regs(uint8 dev, uint8 reg, uint8 *buf, uint16 len)
+{
+    uint16 i;
+
+    if (i2c_queue_head)
+        return I2C_ERR_BUSY;
+    i2c_error = I2C_OK;
+    if (!i2c_select(dev, reg) || !i2c_address(dev, 1))
+        return i2c_finish(0);
+    for (i = 0; i < len; i++) {
+        buf[i] = i2c_readByte();
+        i2c_send_ack(i + 1 < len);
+    }
+    return i2c_finish(1);
+}
+
+/**
+ * Read len bytes without setting a register pointer first, for devices
+ * that are driven by commands rather than registers
+ * returns I2C_OK or one of the I2C_ERR_* codes
+ */
+sint8 ICACHE_FLASH_ATTR
+i2c_read_bytes(uint8 dev, uint8 *buf, uint16 len)
+{
+    uint16 i;
+
+    if (i2c_queue_head)
+        return I2C_ERR_BUSY;
+    i2c_error = I2C_OK;
+    if (!i2c_address(dev, 1))
+        return i2c_finish(0);
+    for (i = 0; i < len; i++) {
+        buf[i] = i2c_readByte();
+        i2c_send_ack(i + 1 < len);
+    }
+    return i2c_finish(1);
+}
+
+/**
+ * Write len bytes to consecutive registers starting at reg in a single
+ * transaction
+ * returns I2C_OK or one of the I2C_ERR_* codes
+ */
+sint8 ICACHE_FLASH_ATTR
+i2c_write_regs(uint8 dev, uint8 reg, const uint8 *buf, uint16 len)
+{
+    uint16 i;
+
+    if (i2c_queue_head)
+        return I2C_ERR_BUSY;
+    i2c_error = I2C_OK;
+    if (!i2c_select(dev, reg))
+        return i2c_finish(0);
+    for (i = 0; i < len; i++) {
+        i2c_writeByte(buf[i]);
+        if (!i2c_check_ack())
+            return i2c_finish(0);
+    }
+    return i2c_finish(1);
+}
+
+/**
+ * Describe a register read: write the register pointer, restart, read
+ * len bytes into buf. reg must stay valid until the callback.
+ */
+void ICACHE_FLASH_ATTR
+i2c_txn_read_regs(struct i2c_txn *txn, uint8 dev, uint8 *reg, uint8 *buf, uint16 len)
+{
+    txn->dev = dev;
+    txn->nseg = 2;
+    txn->seg[0].dir = I2C_SEG_WRITE;
+    txn->seg[0].buf = reg;
+    txn->seg[0].len = 1;
+    txn->seg[1].dir = I2C_SEG_READ;
+    txn->seg[1].buf = buf;
+    txn->seg[1].len = len;
+}
+
+/**
+ * Describe a plain read of len bytes into buf, for devices that are
+ * driven by commands rather than registers
+ */
+void ICACHE_FLASH_ATTR
+i2c_txn_read(struct i2c_txn *txn, uint8 dev, uint8 *buf, uint16 len)
+{
+    txn->dev = dev;
+    txn->nseg = 1;
+    txn->seg[0].dir = I2C_SEG_READ;
+    txn->seg[0].buf = buf;
+    txn->seg[0].len = len;
+}
+
+/**
+ * Describe a register write: data[0] is the register, the rest is
+ * written from there on
+ */
+void ICACHE_FLASH_ATTR
+i2c_txn_write(struct i2c_txn *txn, uint8 dev, uint8 *data, uint16 len)
+{
+    txn->dev = dev;
+    txn->nseg = 1;
+    txn->seg[0].dir = I2C_SEG_WRITE;
+    txn->seg[0].buf = data;
+    txn->seg[0].len = len;
+}
+
+/**
+ * Queue a transaction. It runs from the I2C task in slices of about
+ * I2C_QUEUE_SLICE_US, the SDK gets the CPU back between slices; cb is
+ * called from the task with txn->status set. The descriptor and its
+ * buffers must stay valid until then.
+ * returns I2C_OK, or I2C_ERR_BUSY if txn is still queued
+ */
+sint8 ICACHE_FLASH_ATTR
+i2c_queue_submit(struct i2c_txn *txn, i2c_txn_callback cb, void *arg)
+{
+    struct i2c_txn *t;
+
+    for (t = i2c_queue_head; t; t = t->next)
+        if (t == txn)
+            return I2C_ERR_BUSY;
+
+    txn->cb = cb;
+    txn->arg = arg;
+    txn->status = I2C_OK;
+    txn->next = NULL;
+    if (i2c_queue_head) {
+        i2c_queue_tail->next = txn;
+    } else {
+        i2c_queue_head = txn;
+        i2c_queue_seg = 0;
+        i2c_queue_pos = -1;
+        system_os_post(I2C_QUEUE_TASK_PRIO, 0, 0);
+    }
+    i2c_queue_tail = txn;
+    return I2C_OK;
+}
+
+// Take the finished head off the queue and report it
+LOCAL void ICACHE_FLASH_ATTR
+i2c_queue_complete(sint8 status)
+{
+    struct i2c_txn *txn = i2c_queue_head;
+
+    i2c_queue_head = txn->next;
+    i2c_queue_seg = 0;
+    i2c_queue_pos = -1;
+    txn->status = status;
+    txn->cb(txn);
+}
+
+/**
+ * Queue task: move the head transaction on by one address or data byte
+ * at a time until the slice is used up, then post itself again
+ */
+LOCAL void ICACHE_FLASH_ATTR
+i2c_queue_run(os_event_t *event)
+{
+    uint32 start = system_get_time();
+    struct i2c_txn *txn;
+    struct i2c_segment *seg;
+
+    while ((txn = i2c_queue_head) != NULL) {
+        if (system_get_time() - start >= I2C_QUEUE_SLICE_US) {
+            system_os_post(I2C_QUEUE_TASK_PRIO, 0, 0);
+            return;
+        }
+        seg = &txn->seg[i2c_queue_seg];
+
+        if (i2c_queue_pos < 0) {
+            // (re)start and address for this segment's direction
+            if (i2c_queue_seg == 0)
+                i2c_error = I2C_OK;
+            if (!i2c_address(txn->dev, seg->dir == I2C_SEG_READ)) {
+                i2c_queue_complete(i2c_finish(0));
+                continue;
+            }
+            i2c_queue_pos = 0;
+        } else if (i2c_queue_pos < seg->len) {
+            if (seg->dir == I2C_SEG_READ) {
+                seg->buf[i2c_queue_pos] = i2c_readByte();
+                i2c_send_ack(i2c_queue_pos + 1 < seg->len);
+            } else {
+                i2c_writeByte(seg->buf[i2c_queue_pos]);
+                if (!i2c_check_ack()) {
+                    i2c_queue_complete(i2c_finish(0));
+                    continue;
+                }
+            }
+            if (i2c_error != I2C_OK) {
+                // stretch timeout or stuck bus, the rest would be garbage
+                i2c_queue_complete(i2c_finish(0));
+                continue;
+            }
+            i2c_queue_pos++;
+        } else if (++i2c_queue_seg < txn->nseg) {
+            i2c_queue_pos = -1;
+        } else {
+            i2c_queue_complete(i2c_finish(1));
+        }
     }
 }
+
+/**
+ * Measure the read throughput against the device at addr (7 bit)
+ * Reads len bytes in one transaction, continuing from the device's
+ * current register pointer
+ * returns bytes per second, 0 if the device did not answer, or
+ * I2C_ERR_BUSY while queued transactions own the bus
+ */
+sint32 ICACHE_FLASH_ATTR
+i2c_benchmark(uint8 addr, uint16 len)
+{
+    uint32 start, elapsed;
+    uint16 i;
+
+    if (i2c_queue_head)
+        return I2C_ERR_BUSY;
+    if (len == 0)
+        return 0;
+
+    start = system_get_time();
+    i2c_error = I2C_OK;
+    if (!i2c_address(addr, 1)) {
+        i2c_finish(0);
+        return 0;
+    }
+    for (i = 0; i < len; i++) {
+        i2c_readByte();
+        i2c_send_ack(i + 1 < len);
+    }
+    if (i2c_finish(1) != I2C_OK)
+        return 0;
+    elapsed = system_get_time() - start;
+
+    return elapsed ? (sint32)((uint64)len * 1000000 / elapsed) : 0;
+}
@@ -22,165 +22,81 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
-#include <math.h>
+#include "user_interface.h"
 #include "driver/i2c.h"
 #include "driver/i2c_bmp180.h"
 
+#define LOG_MODULE_LEVEL LOG_LEVEL_BMP180
+#define LOG_PRINTF ets_uart_printf
+#include "log.h"
+
+extern int ets_uart_printf(const char *fmt, ...);
+
 int16_t ac1, ac2, ac3;
 uint16_t ac4, ac5, ac6;
 int16_t b1, b2;
 int16_t mb, mc, md; 
 
-int16_t ICACHE_FLASH_ATTR BMP180_readRegister16(uint8_t reg)
-{
-	i2c_start();
-	i2c_writeByte(BMP180_W);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRegister16: i2c_writeByte(0xEE) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_writeByte(reg);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRegister16: i2c_writeByte(reg) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_start();
-	i2c_writeByte(BMP180_R);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRegister16: i2c_writeByte(0xEF) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	uint8_t msb = i2c_readByte();
-	i2c_send_ack(1);
-	uint8_t lsb = i2c_readByte();
-	i2c_send_ack(0);
-	i2c_stop();
-	int16_t res = (msb << 8) + lsb;
-	//int16_t res = (msb << 8) | lsb;
-	return res;
-}
-
-int16_t ICACHE_FLASH_ATTR BMP180_readExRegister16(uint8_t reg, enum PRESSURE_RESOLUTION resolution)
-{
-	i2c_start();
-	i2c_writeByte(BMP180_W);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRegister16: i2c_writeByte(0xEE) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_writeByte(reg);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRegister16: i2c_writeByte(reg) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_start();
-	i2c_writeByte(BMP180_R);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRegister16: i2c_writeByte(0xEF) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	uint8_t msb = i2c_readByte();
-	i2c_send_ack(1);
-	uint8_t lsb = i2c_readByte();
-	i2c_send_ack(0);
-	uint8_t xlsb = i2c_readByte();
-	i2c_send_ack(0);
-	i2c_stop();
-	int32_t res = ((msb << 16) + (lsb << 8) + xlsb) >> (8-resolution);
-	return res;
-}
-
-int16_t ICACHE_FLASH_ATTR BMP180_readRawValue(uint8_t cmd)
-{
-	i2c_start();
-	i2c_writeByte(BMP180_W);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRawValue: i2c_writeByte(0xEE) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_writeByte(BMP180_CTRL_REG);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRawValue: i2c_writeByte(0xF4) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
+sint8 ICACHE_FLASH_ATTR BMP180_readRegister16(uint8_t reg, int16_t *value)
+{
+	uint8_t buf[2];
+	sint8 status;
+
+	status = i2c_read_regs(BMP180_ADDR, reg, buf, sizeof(buf));
+	if (status != I2C_OK) {
+		LOG_E("BMP180_readRegister16: i2c error %d\r\n", status);
+		return status;
 	}
-	i2c_writeByte(cmd);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readRawValue: i2c_writeByte(cmd) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
+	*value = (buf[0] << 8) + buf[1];
+	return I2C_OK;
+}
+
+sint8 ICACHE_FLASH_ATTR BMP180_readExRegister16(uint8_t reg, enum PRESSURE_RESOLUTION resolution, int32_t *value)
+{
+	uint8_t buf[3];
+	sint8 status;
+
+	status = i2c_read_regs(BMP180_ADDR, reg, buf, sizeof(buf));
+	if (status != I2C_OK) {
+		LOG_E("BMP180_readExRegister16: i2c error %d\r\n", status);
+		return status;
 	}
-	i2c_stop();
+	// MSB, LSB and the top oversampling bits of XLSB: 16 to 19 bits of UP
+	*value = (((int32_t)buf[0] << 16) | ((int32_t)buf[1] << 8) | buf[2]) >> (8-resolution);
+	return I2C_OK;
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR BMP180_startConversion(uint8_t cmd)
+{
+	sint8 status;
+
+	status = i2c_write_regs(BMP180_ADDR, BMP180_CTRL_REG, &cmd, 1);
+	if (status != I2C_OK)
+		LOG_E("BMP180_startConversion: i2c error %d\r\n", status);
+	return status;
+}
+
+sint8 ICACHE_FLASH_ATTR BMP180_readRawValue(uint8_t cmd, int32_t *value)
+{
+	int16_t raw;
+	sint8 status;
+
+	status = BMP180_startConversion(cmd);
+	if (status != I2C_OK)
+		return status;
 	os_delay_us(CONVERSION_TIME*900); // max time is 4.5ms
-	int16_t res = BMP180_readRegister16(BMP180_DATA_REG);
-	return res;
+	status = BMP180_readRegister16(BMP180_DATA_REG, &raw);
+	*value = raw;
+	return status;
 }
 
-int16_t ICACHE_FLASH_ATTR BMP180_readExRawValue(uint8_t cmd, enum PRESSURE_RESOLUTION resolution)
+sint8 ICACHE_FLASH_ATTR BMP180_readExRawValue(uint8_t cmd, enum PRESSURE_RESOLUTION resolution, int32_t *value)
 {
-	i2c_start();
-	i2c_writeByte(BMP180_W);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRawValue: i2c_writeByte(0xEE) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_writeByte(BMP180_CTRL_REG);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRawValue: i2c_writeByte(0xF4) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_writeByte(cmd);
-	if(!i2c_check_ack()){
-		#ifdef BMP180_DEBUG
-		//os_printf("slave not ack..\n return \n");
-		ets_uart_printf("BMP180_readExRawValue: i2c_writeByte(cmd) slave not ack..\r\nreturn\r\n");
-		#endif
-		i2c_stop();
-		return(0);
-	}
-	i2c_stop();
+	sint8 status;
+
+	status = BMP180_startConversion(cmd);
+	if (status != I2C_OK)
+		return status;
 	switch(resolution)
 	{
 		case OSS_0:
@@ -198,80 +114,159 @@ int16_t ICACHE_FLASH_ATTR BMP180_readExRawValue(uint8_t cmd, enum PRESSURE_RESOL
 		default:
 			os_delay_us(CONVERSION_TIME*900);
 	}
-	int16_t res = BMP180_readExRegister16(BMP180_DATA_REG, resolution);
-	return res;
+	return BMP180_readExRegister16(BMP180_DATA_REG, resolution, value);
 }
 
-bool ICACHE_FLASH_ATTR BMP180_Init()
+// Calibration block kept in RTC user memory across deep sleep, 32 bytes
+struct bmp180_cal_cache {
+	uint32_t magic;
+	uint16_t chip_id;
+	uint16_t sum;			// Fletcher-16 over chip_id and cal
+	uint8_t cal[BMP180_CAL_LEN];
+	uint8_t pad[2];
+};
+
+// calibration block as read from the sensor, for BMP180_GetCalibration()
+static uint8_t bmp_cal[BMP180_CAL_LEN];
+static bool bmp_cal_loaded = 0;
+
+LOCAL uint16_t ICACHE_FLASH_ATTR BMP180_calSum(uint16_t chip_id, const uint8_t *cal)
 {
-	i2c_init();
-	int16_t version = BMP180_readRegister16(BMP180_CHIP_ID_REG);
-	if (version != BMP180_CHIP_ID) {
-		#ifdef BMP180_DEBUG
-		char temp[80];
-		os_sprintf(temp, "BMP180: wanted chip id 0x%X, found chip id 0x%X\r\n",
-				  BMP180_CHIP_ID, version);
-		ets_uart_printf(temp);
-		#endif
-	    return 0;
+	uint16_t s1 = 0, s2 = 0;
+	uint8_t i, b;
+
+	for (i = 0; i < BMP180_CAL_LEN + 2; i++) {
+		// chip id high and low byte, then the calibration block
+		b = i < 2 ? chip_id >> (8 - 8 * i) : cal[i - 2];
+		s1 = (s1 + b) % 255;
+		s2 = (s2 + s1) % 255;
 	}
+	return (s2 << 8) | s1;
+}
 
-	if (!BMP180_readRegister16(BMP180_VERSION_REG))
+//
+// Reuse the calibration saved before deep sleep. Any other reset reads
+// the sensor again, as does a cache that fails the checksum.
+//
+LOCAL bool ICACHE_FLASH_ATTR BMP180_loadCalibration(uint8_t *cal)
+{
+	struct bmp180_cal_cache cache;
+
+	if (system_get_rst_info()->reason != REASON_DEEP_SLEEP_AWAKE)
+		return 0;
+	system_rtc_mem_read(BMP180_CAL_RTC_BLOCK, &cache, sizeof(cache));
+	if (cache.magic != BMP180_CAL_RTC_MAGIC || cache.chip_id != BMP180_CHIP_ID
+			|| cache.sum != BMP180_calSum(cache.chip_id, cache.cal))
 		return 0;
+	os_memcpy(cal, cache.cal, BMP180_CAL_LEN);
+	return 1;
+}
+
+LOCAL void ICACHE_FLASH_ATTR BMP180_storeCalibration(const uint8_t *cal)
+{
+	struct bmp180_cal_cache cache;
+
+	os_memset(&cache, 0, sizeof(cache));
+	cache.magic = BMP180_CAL_RTC_MAGIC;
+	cache.chip_id = BMP180_CHIP_ID;
+	os_memcpy(cache.cal, cal, BMP180_CAL_LEN);
+	cache.sum = BMP180_calSum(cache.chip_id, cache.cal);
+	system_rtc_mem_write(BMP180_CAL_RTC_BLOCK, &cache, sizeof(cache));
+}
+
+// Everything BMP180_Init() does once the bus is set up
+LOCAL bool ICACHE_FLASH_ATTR BMP180_setup(void)
+{
+	uint8_t cal[BMP180_CAL_LEN];
 
-	#ifdef BMP180_DEBUG
-	//os_printf("BMP180 read calibration data...\r\n");
-	ets_uart_printf("BMP180 read calibration data...\r\n");
-	#endif
-	ac1 = BMP180_readRegister16(0xAA);
-	ac2 = BMP180_readRegister16(0xAC);
-	ac3 = BMP180_readRegister16(0xAE);
-	ac4 = BMP180_readRegister16(0xB0);
-	ac5 = BMP180_readRegister16(0xB2);
-	ac6 = BMP180_readRegister16(0xB4);
-	b1 =  BMP180_readRegister16(0xB6);
-	b2 =  BMP180_readRegister16(0xB8);
-	mb =  BMP180_readRegister16(0xBA);
-	mc =  BMP180_readRegister16(0xBC);
-	md =  BMP180_readRegister16(0xBE);
-
-	#ifdef BMP180_DEBUG
-	ets_uart_printf("BMP180_Calibration:\r\n");
-	char temp[128];
-	os_sprintf(temp, "AC1: %ld, AC2: %ld, AC3: %ld, AC4: %ld, AC5: %ld, AC6: %ld, B1: %ld, B2: %ld, MB: %ld, MC: %ld, MD: %ld\r\n",
-				ac1, ac2, ac3, ac4, ac5, ac6, b1, b2, mb, mc, md);
-	ets_uart_printf(temp);
-	#endif
+	if (!BMP180_loadCalibration(cal)) {
+		int16_t version;
+		if (BMP180_readRegister16(BMP180_CHIP_ID_REG, &version) != I2C_OK)
+			return 0;
+		if (version != BMP180_CHIP_ID) {
+			LOG_E("BMP180: wanted chip id 0x%X, found chip id 0x%X\r\n", BMP180_CHIP_ID, version);
+		    return 0;
+		}
+
+		LOG_I("BMP180 read calibration data...\r\n");
+		// all eleven big endian words in one transaction
+		if (i2c_read_regs(BMP180_ADDR, BMP180_CAL_REG, cal, sizeof(cal)) != I2C_OK)
+			return 0;
+		BMP180_storeCalibration(cal);
+	}
+
+	os_memcpy(bmp_cal, cal, BMP180_CAL_LEN);
+	#define CAL_WORD(i) ((cal[2*(i)] << 8) | cal[2*(i)+1])
+	ac1 = CAL_WORD(0);
+	ac2 = CAL_WORD(1);
+	ac3 = CAL_WORD(2);
+	ac4 = CAL_WORD(3);
+	ac5 = CAL_WORD(4);
+	ac6 = CAL_WORD(5);
+	b1 =  CAL_WORD(6);
+	b2 =  CAL_WORD(7);
+	mb =  CAL_WORD(8);
+	mc =  CAL_WORD(9);
+	md =  CAL_WORD(10);
+	#undef CAL_WORD
+
+	bmp_cal_loaded = 1;
+
+	LOG_D("BMP180_Calibration:\r\n");
+	LOG_D("AC1: %d, AC2: %d, AC3: %d, AC4: %d, AC5: %d, AC6: %d, B1: %d, B2: %d, MB: %d, MC: %d, MD: %d\r\n",
+			ac1, ac2, ac3, ac4, ac5, ac6, b1, b2, mb, mc, md);
 	return 1;
 }
 
-int32_t ICACHE_FLASH_ATTR BMP180_GetTemperature()
+bool ICACHE_FLASH_ATTR BMP180_Init()
 {
-	int32_t UT;
-	int32_t B5, X1, X2, T;
-	UT = BMP180_readRawValue(BMP_CMD_MEASURE_TEMP);
+	i2c_init();
+	return BMP180_setup();
+}
+
+//
+// Every result needs the calibration: with AC1..MD still zero B5 divides
+// by zero. Retry the setup if BMP180_Init() could not finish it.
+//
+LOCAL sint8 ICACHE_FLASH_ATTR BMP180_ready(void)
+{
+	if (bmp_cal_loaded || BMP180_setup())
+		return I2C_OK;
+	return I2C_ERR_NOT_READY;
+}
+
+//
+// Copy the 22 byte calibration block (AC1..MD, big endian) to cal
+//
+void ICACHE_FLASH_ATTR BMP180_GetCalibration(uint8_t *cal)
+{
+	os_memcpy(cal, bmp_cal, BMP180_CAL_LEN);
+}
+
+//
+// Fletcher-16 over the chip id and the calibration block, lets the
+// collector tell whether it already holds the right calibration
+//
+uint16_t ICACHE_FLASH_ATTR BMP180_CalibrationHash(void)
+{
+	return BMP180_calSum(BMP180_CHIP_ID, bmp_cal);
+}
+
+// Temperature compensation, B5 is shared with the pressure formula
+LOCAL int32_t ICACHE_FLASH_ATTR BMP180_calcB5(int32_t UT)
+{
+	int32_t X1, X2;
 	X1 = (UT - (int32_t)ac6) * ((int32_t)ac5) >> 15;
 	X2 = ((int32_t)mc << 11) / (X1 + (int32_t)md);
-	B5 = X1 + X2;
-	T  = (B5+8) >> 4;
-	return (T);
+	return X1 + X2;
 }
 
-int32_t ICACHE_FLASH_ATTR BMP180_GetPressure(enum PRESSURE_RESOLUTION resolution)
+LOCAL int32_t ICACHE_FLASH_ATTR BMP180_calcPressure(int32_t UP, int32_t B5, enum PRESSURE_RESOLUTION resolution)
 {
-	int32_t UT;
-	uint16_t UP;
-	int32_t B3, B5, B6;
+	int32_t B3, B6;
 	uint32_t B4, B7;
 	int32_t X1, X2, X3;
 	int32_t P;
-	UT = BMP180_readRawValue(BMP_CMD_MEASURE_TEMP);
-	UP = BMP180_readExRawValue(BMP_CMD_MEASURE_PRESSURE_0+(resolution<<6), resolution);
-	// Calculate temperature
-	X1 = (UT - (int32_t)ac6) * ((int32_t)ac5) >> 15;
-	X2 = ((int32_t)mc << 11) / (X1 + (int32_t)md);
-	B5 = X1 + X2;
-	// Calculate pressure
 	B6 = B5 - 4000;
 	X1 = ((int32_t)b2 * ((B6 * B6) >> 12)) >> 11;
 	X2 = ((int32_t)ac2 * B6) >> 11;
@@ -290,13 +285,380 @@ int32_t ICACHE_FLASH_ATTR BMP180_GetPressure(enum PRESSURE_RESOLUTION resolution
 	X1 = (P >> 8) * (P >> 8);
 	X1 = (X1 * 3038) >> 16;
 	X2 = (-7357 * P) >> 16;
-	P = P + ((X1 + X2 + (int32_t)3791) >> 4);
-	return P;
+	return P + ((X1 + X2 + (int32_t)3791) >> 4);
+}
+
+sint8 ICACHE_FLASH_ATTR BMP180_GetTemperature(int32_t *temperature)
+{
+	int32_t UT;
+	sint8 status;
+	status = BMP180_ready();
+	if (status != I2C_OK)
+		return status;
+	status = BMP180_readRawValue(BMP_CMD_MEASURE_TEMP, &UT);
+	if (status != I2C_OK)
+		return status;
+	*temperature = (BMP180_calcB5(UT)+8) >> 4;
+	return I2C_OK;
+}
+
+sint8 ICACHE_FLASH_ATTR BMP180_GetPressure(enum PRESSURE_RESOLUTION resolution, int32_t *pressure)
+{
+	int32_t UT;
+	int32_t UP;
+	sint8 status;
+	status = BMP180_ready();
+	if (status != I2C_OK)
+		return status;
+	status = BMP180_readRawValue(BMP_CMD_MEASURE_TEMP, &UT);
+	if (status != I2C_OK)
+		return status;
+	status = BMP180_readExRawValue(BMP180_PRESSURE_CMD(resolution), resolution, &UP);
+	if (status != I2C_OK)
+		return status;
+	*pressure = BMP180_calcPressure(UP, BMP180_calcB5(UT), resolution);
+	return I2C_OK;
+}
+
+/*
+ * Non-blocking measurement. BMP180_Measure() queues a conversion and
+ * returns; a timer then either polls the Sco bit of the control register
+ * or waits the datasheet conversion time, reads the result and starts
+ * the next step. Every bus access goes through the I2C transaction
+ * queue, so no step holds the CPU for longer than one queue slice.
+ * A temperature younger than BMP180_B5_MAX_AGE is reused
+ * for the pressure compensation instead of converting it again, and in
+ * averaging mode several pressure conversions follow one temperature.
+ * In raw mode only UT and the mean UP are returned, the compensation is
+ * left to the collector (tools/bmp180_compensate.py).
+ */
+
+enum bmp180_state {
+	BMP180_IDLE,
+	BMP180_CONV_TEMP,
+	BMP180_CONV_PRESSURE
+};
+
+static ETSTimer bmp_timer;
+static bmp180_callback bmp_cb;
+static struct bmp180_result bmp_result;
+static enum bmp180_state bmp_state = BMP180_IDLE;
+static enum bmp180_wait_mode bmp_mode;
+static enum PRESSURE_RESOLUTION bmp_oss;
+static uint16_t bmp_poll_left;
+static uint16_t bmp_wait;
+static uint8_t bmp_samples;
+static uint8_t bmp_samples_left;
+static int32_t bmp_pressure_sum;
+
+static int32_t bmp_up_sum;
+static bool bmp_raw;
+static int32_t bmp_b5;
+
+// queued transaction and its buffers
+static struct i2c_txn bmp_txn;
+static uint8_t bmp_tx[2];
+static uint8_t bmp_rx[3];
+
+// last raw temperature and when it was measured
+static int32_t bmp_ut;
+static uint32_t bmp_ut_time;
+static bool bmp_ut_valid = 0;
+
+// datasheet maximum conversion times rounded up to whole ms
+#define BMP180_TEMP_TIME	5	// 4.5 ms
+static const uint8_t bmp_pressure_time[4] = { 5, 8, 14, 26 };	// 4.5, 7.5, 13.5, 25.5 ms
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_step(void *arg);
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_finish(sint8 status)
+{
+	os_timer_disarm(&bmp_timer);
+	bmp_state = BMP180_IDLE;
+	bmp_result.status = status;
+	bmp_cb(&bmp_result);
 }
 
+LOCAL void ICACHE_FLASH_ATTR bmp180_started(struct i2c_txn *txn)
+{
+	if (txn->status != I2C_OK) {
+		LOG_E("bmp180_started: i2c error %d\r\n", txn->status);
+		bmp180_finish(txn->status);
+		return;
+	}
+	os_timer_disarm(&bmp_timer);
+	os_timer_setfn(&bmp_timer, (os_timer_func_t *)bmp180_step, NULL);
+	if (bmp_mode == BMP180_WAIT_POLL) {
+		bmp_poll_left = bmp_wait / BMP180_POLL_INTERVAL + 2;
+		os_timer_arm(&bmp_timer, BMP180_POLL_INTERVAL, 0);
+	} else {
+		os_timer_arm(&bmp_timer, bmp_wait, 0);
+	}
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_convert(enum bmp180_state state, uint8_t cmd, uint16_t time)
+{
+	bmp_state = state;
+	bmp_wait = time;
+	bmp_tx[0] = BMP180_CTRL_REG;
+	bmp_tx[1] = cmd;
+	i2c_txn_write(&bmp_txn, BMP180_ADDR, bmp_tx, 2);
+	return i2c_queue_submit(&bmp_txn, bmp180_started, NULL);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_convert_pressure(void)
+{
+	return bmp180_convert(BMP180_CONV_PRESSURE,
+			BMP180_PRESSURE_CMD(bmp_oss), bmp_pressure_time[bmp_oss]);
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_use_temperature(void)
+{
+	bmp_result.ut = bmp_ut;
+	if (!bmp_raw) {
+		bmp_b5 = BMP180_calcB5(bmp_ut);
+		bmp_result.temperature = (bmp_b5 + 8) >> 4;
+	}
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_fetched(struct i2c_txn *txn)
+{
+	int32_t UP;
+	sint8 status;
+
+	if (txn->status != I2C_OK) {
+		bmp180_finish(txn->status);
+		return;
+	}
+
+	if (bmp_state == BMP180_CONV_TEMP) {
+		bmp_ut = (int16_t)((bmp_rx[0] << 8) + bmp_rx[1]);
+		bmp_ut_time = system_get_time();
+		bmp_ut_valid = 1;
+		bmp180_use_temperature();
+		status = bmp180_convert_pressure();
+		if (status != I2C_OK)
+			bmp180_finish(status);
+		return;
+	}
+
+	UP = (((int32_t)bmp_rx[0] << 16) | ((int32_t)bmp_rx[1] << 8) | bmp_rx[2]) >> (8-bmp_oss);
+	bmp_up_sum += UP;
+	if (!bmp_raw)
+		bmp_pressure_sum += BMP180_calcPressure(UP, bmp_b5, bmp_oss);
+	if (--bmp_samples_left > 0) {
+		// the result registers are read, start the next sample right away
+		status = bmp180_convert_pressure();
+		if (status != I2C_OK)
+			bmp180_finish(status);
+		return;
+	}
+	bmp_result.up = (bmp_up_sum + bmp_samples / 2) / bmp_samples;
+	if (!bmp_raw)
+		bmp_result.pressure = (bmp_pressure_sum + bmp_samples / 2) / bmp_samples;
+	bmp180_finish(I2C_OK);
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_fetch(void)
+{
+	sint8 status;
+
+	bmp_tx[0] = BMP180_DATA_REG;
+	i2c_txn_read_regs(&bmp_txn, BMP180_ADDR, bmp_tx, bmp_rx,
+			bmp_state == BMP180_CONV_TEMP ? 2 : 3);
+	status = i2c_queue_submit(&bmp_txn, bmp180_fetched, NULL);
+	if (status != I2C_OK)
+		bmp180_finish(status);
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_polled(struct i2c_txn *txn)
+{
+	if (txn->status != I2C_OK) {
+		bmp180_finish(txn->status);
+		return;
+	}
+	// Sco stays set until the result registers are updated
+	if (bmp_rx[0] & BMP180_SCO_BIT) {
+		if (--bmp_poll_left == 0)
+			bmp180_finish(I2C_ERR_TIMEOUT);
+		else
+			os_timer_arm(&bmp_timer, BMP180_POLL_INTERVAL, 0);
+		return;
+	}
+	bmp180_fetch();
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_step(void *arg)
+{
+	sint8 status;
+
+	os_timer_disarm(&bmp_timer);
+
+	if (bmp_mode != BMP180_WAIT_POLL) {
+		bmp180_fetch();
+		return;
+	}
+	bmp_tx[0] = BMP180_CTRL_REG;
+	i2c_txn_read_regs(&bmp_txn, BMP180_ADDR, bmp_tx, bmp_rx, 1);
+	status = i2c_queue_submit(&bmp_txn, bmp180_polled, NULL);
+	if (status != I2C_OK)
+		bmp180_finish(status);
+}
+
+//
+// Start a temperature and pressure measurement. Returns I2C_OK once the
+// first conversion is queued, cb is then called from timer or I2C task
+// context with the result, bus errors included. A measurement already in
+// progress is not interrupted.
+//
+sint8 ICACHE_FLASH_ATTR BMP180_Measure(enum PRESSURE_RESOLUTION resolution, enum bmp180_wait_mode mode, bmp180_callback cb)
+{
+	return BMP180_MeasureAverage(resolution, 1, mode, cb);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_start(enum PRESSURE_RESOLUTION resolution, uint8_t samples, bool raw, enum bmp180_wait_mode mode, bmp180_callback cb)
+{
+	sint8 status;
+
+	if (bmp_state != BMP180_IDLE)
+		return I2C_ERR_BUSY;
+	status = BMP180_ready();
+	if (status != I2C_OK)
+		return status;
+
+	bmp_cb = cb;
+	bmp_mode = mode;
+	bmp_raw = raw;
+	bmp_oss = resolution & 3;
+	bmp_samples = samples ? samples : 1;
+	bmp_samples_left = bmp_samples;
+	bmp_pressure_sum = 0;
+	bmp_up_sum = 0;
+	os_memset(&bmp_result, 0, sizeof(bmp_result));
+	bmp_result.oss = bmp_oss;
+
+	if (bmp_ut_valid && system_get_time() - bmp_ut_time < BMP180_B5_MAX_AGE * 1000) {
+		bmp180_use_temperature();
+		status = bmp180_convert_pressure();
+	} else {
+		status = bmp180_convert(BMP180_CONV_TEMP, BMP_CMD_MEASURE_TEMP, BMP180_TEMP_TIME);
+	}
+	if (status != I2C_OK)
+		bmp_state = BMP180_IDLE;
+	return status;
+}
+
+//
+// As BMP180_Measure(), but report the mean of samples back to back
+// pressure conversions compensated with one temperature. Four OSS_3
+// samples take about 110 ms and average the noise down by half.
+//
+sint8 ICACHE_FLASH_ATTR BMP180_MeasureAverage(enum PRESSURE_RESOLUTION resolution, uint8_t samples, enum bmp180_wait_mode mode, bmp180_callback cb)
+{
+	return bmp180_start(resolution, samples, 0, mode, cb);
+}
+
+//
+// As BMP180_MeasureAverage(), but only UT, the mean UP and OSS are filled
+// in; temperature and pressure stay 0 for the collector to compute.
+//
+sint8 ICACHE_FLASH_ATTR BMP180_MeasureRaw(enum PRESSURE_RESOLUTION resolution, uint8_t samples, enum bmp180_wait_mode mode, bmp180_callback cb)
+{
+	return bmp180_start(resolution, samples, 1, mode, cb);
+}
+
+/*
+ * BMP180 entry for the I2C sensor registry, see i2c_sensor.h. One
+ * temperature and one BMP180_SENSOR_OSS pressure conversion per reading.
+ */
+
+struct bmp180_sensor_state {
+	int32_t b5;
+	uint8_t stage;		// 0 converting temperature, 1 pressure
+};
+
+LOCAL bool ICACHE_FLASH_ATTR bmp180_sensor_probe(struct i2c_sensor *dev)
+{
+	return BMP180_setup();
+}
+
+// Write a conversion command, the step ends when it is on the bus
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_sensor_convert(struct i2c_sensor *dev, uint8_t cmd, i2c_txn_callback cb)
+{
+	dev->tx[0] = BMP180_CTRL_REG;
+	dev->tx[1] = cmd;
+	i2c_txn_write(&dev->txn, dev->addr, dev->tx, 2);
+	return i2c_queue_submit(&dev->txn, cb, dev);
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_sensor_converting(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+	struct bmp180_sensor_state *st = (struct bmp180_sensor_state *)dev->priv;
+
+	if (txn->status != I2C_OK)
+		i2c_sensor_done(dev, txn->status);
+	else
+		i2c_sensor_done(dev, st->stage == 0 ? BMP180_TEMP_TIME : bmp_pressure_time[BMP180_SENSOR_OSS]);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_sensor_start(struct i2c_sensor *dev)
+{
+	struct bmp180_sensor_state *st = (struct bmp180_sensor_state *)dev->priv;
+
+	st->stage = 0;
+	return bmp180_sensor_convert(dev, BMP_CMD_MEASURE_TEMP, bmp180_sensor_converting);
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_sensor_fetched(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+	struct bmp180_sensor_state *st = (struct bmp180_sensor_state *)dev->priv;
+	struct i2c_sensor_reading *r = dev->reading;
+	int32_t UP;
+	sint8 status;
+
+	if (txn->status != I2C_OK) {
+		i2c_sensor_done(dev, txn->status);
+		return;
+	}
+
+	if (st->stage == 0) {
+		st->b5 = BMP180_calcB5((int16_t)((dev->rx[0] << 8) + dev->rx[1]));
+		st->stage = 1;
+		status = bmp180_sensor_convert(dev, BMP180_PRESSURE_CMD(BMP180_SENSOR_OSS), bmp180_sensor_converting);
+		if (status != I2C_OK)
+			i2c_sensor_done(dev, status);
+		return;
+	}
+
+	UP = (((int32_t)dev->rx[0] << 16) | ((int32_t)dev->rx[1] << 8) | dev->rx[2]) >> (8 - BMP180_SENSOR_OSS);
+	r->temperature = ((st->b5 + 8) >> 4) * 10;
+	r->pressure = BMP180_calcPressure(UP, st->b5, BMP180_SENSOR_OSS);
+	r->valid = I2C_SENSOR_TEMPERATURE | I2C_SENSOR_PRESSURE;
+	i2c_sensor_done(dev, 0);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR bmp180_sensor_read(struct i2c_sensor *dev)
+{
+	struct bmp180_sensor_state *st = (struct bmp180_sensor_state *)dev->priv;
+
+	dev->tx[0] = BMP180_DATA_REG;
+	i2c_txn_read_regs(&dev->txn, dev->addr, dev->tx, dev->rx, st->stage == 0 ? 2 : 3);
+	return i2c_queue_submit(&dev->txn, bmp180_sensor_fetched, dev);
+}
+
+const struct i2c_sensor_driver bmp180_sensor = {
+	"BMP180",
+	{ BMP180_ADDR, 0 },
+	bmp180_sensor_probe,
+	bmp180_sensor_start,
+	bmp180_sensor_read
+};
+
 int32_t ICACHE_FLASH_ATTR BMP180_CalcAltitude(int32_t pressure)
 {
-	return (int32_t)(pow(((float)MYALTITUDE/44330)+1,5.255F)*pressure);
+	return BMP180_SeaLevelPressure(pressure, (int32_t)(MYALTITUDE * 10));
 }
 
 char* ICACHE_FLASH_ATTR BMP180_Int2String(char* buffer, int32_t value)
@@ -0,0 +1,184 @@
+/*
+    Registry of I2C sensor drivers sharing the bit-banged bus in i2c.c
+
+    i2c_sensor_init() probes every address of every driver in
+    i2c_sensor_drivers[]. i2c_sensor_sample() then starts a conversion on
+    each sensor found and services them from one timer, always armed for
+    the sensor that is due next, so the conversions overlap. The drivers'
+    transfers go through the I2C queue, a sensor is not due again until
+    its driver has called i2c_sensor_done().
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "user_interface.h"
+#include "driver/i2c.h"
+#include "driver/i2c_sensor.h"
+#include "driver/i2c_bmp180.h"
+#include "driver/bme280.h"
+#include "driver/sht3x.h"
+
+// probed in this order; BMP180, BMP280 and BME280 may all sit on 0x77
+// and are told apart by their chip id
+static const struct i2c_sensor_driver *const i2c_sensor_drivers[] = {
+	&bmp180_sensor,
+	&bmp280_sensor,
+	&bme280_sensor,
+	&sht3x_sensor
+};
+
+static struct i2c_sensor sensors[I2C_SENSOR_MAX];
+static struct i2c_sensor_reading readings[I2C_SENSOR_MAX];
+static uint32 sensor_due[I2C_SENSOR_MAX];	// system_get_time() of the next read
+static uint8 sensor_count;
+static uint8 sensor_pending;			// devices still converting, bit mask
+static uint8 sensor_queued;			// devices with a step in the I2C queue
+static ETSTimer sensor_timer;
+static i2c_sensor_callback sensor_cb;
+
+LOCAL bool ICACHE_FLASH_ATTR
+i2c_sensor_taken(uint8 addr)
+{
+	uint8 i;
+
+	for (i = 0; i < sensor_count; i++)
+		if (sensors[i].addr == addr)
+			return 1;
+	return 0;
+}
+
+//
+// Probe the bus for every known sensor. Returns the number found.
+//
+uint8 ICACHE_FLASH_ATTR
+i2c_sensor_init(void)
+{
+	const struct i2c_sensor_driver *drv;
+	struct i2c_sensor *dev;
+	uint8 d, a;
+
+	i2c_init();
+	sensor_count = 0;
+	for (d = 0; d < sizeof(i2c_sensor_drivers) / sizeof(i2c_sensor_drivers[0]); d++) {
+		drv = i2c_sensor_drivers[d];
+		for (a = 0; a < sizeof(drv->addr) && sensor_count < I2C_SENSOR_MAX; a++) {
+			if (drv->addr[a] == 0 || i2c_sensor_taken(drv->addr[a]))
+				continue;
+			dev = &sensors[sensor_count];
+			os_memset(dev, 0, sizeof(*dev));
+			dev->driver = drv;
+			dev->addr = drv->addr[a];
+			if (drv->probe(dev))
+				sensor_count++;
+		}
+	}
+	return sensor_count;
+}
+
+// Book the outcome of a step of sensor i
+LOCAL void ICACHE_FLASH_ATTR
+i2c_sensor_next(uint8 i, sint16 next)
+{
+	sensor_queued &= ~(1 << i);
+	if (next > 0) {
+		sensor_due[i] = system_get_time() + next * 1000;
+		return;
+	}
+	readings[i].status = next;
+	sensor_pending &= ~(1 << i);
+}
+
+LOCAL void ICACHE_FLASH_ATTR i2c_sensor_step(void *arg);
+
+LOCAL void ICACHE_FLASH_ATTR
+i2c_sensor_schedule(void)
+{
+	uint32 now = system_get_time();
+	sint32 wait, soonest = 0x7FFFFFFF;
+	uint8 i;
+
+	os_timer_disarm(&sensor_timer);
+	if (!sensor_pending) {
+		sensor_cb(sensors, readings, sensor_count);
+		return;
+	}
+	for (i = 0; i < sensor_count; i++) {
+		if (!(sensor_pending & ~sensor_queued & (1 << i)))
+			continue;
+		wait = (sint32)(sensor_due[i] - now);
+		if (wait < soonest)
+			soonest = wait;
+	}
+	// all in the queue, the next i2c_sensor_done() schedules again
+	if (soonest == 0x7FFFFFFF)
+		return;
+	os_timer_setfn(&sensor_timer, (os_timer_func_t *)i2c_sensor_step, NULL);
+	os_timer_arm(&sensor_timer, soonest <= 1000 ? 1 : (soonest + 999) / 1000, 0);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+i2c_sensor_step(void *arg)
+{
+	uint32 now = system_get_time();
+	sint8 status;
+	uint8 i;
+
+	for (i = 0; i < sensor_count; i++) {
+		if (!(sensor_pending & ~sensor_queued & (1 << i)) || (sint32)(now - sensor_due[i]) < 0)
+			continue;
+		sensor_queued |= 1 << i;
+		status = sensors[i].driver->read(&sensors[i]);
+		if (status != I2C_OK)
+			i2c_sensor_next(i, status);
+	}
+	i2c_sensor_schedule();
+}
+
+//
+// Called by a driver's completion callback to end the step that start()
+// or read() queued, see i2c_sensor.h for next
+//
+void ICACHE_FLASH_ATTR
+i2c_sensor_done(struct i2c_sensor *dev, sint16 next)
+{
+	i2c_sensor_next(dev - sensors, next);
+	i2c_sensor_schedule();
+}
+
+//
+// Take one reading from every sensor found by i2c_sensor_init(). Returns
+// I2C_OK once the conversions are running; cb is then called from timer
+// context with one reading per sensor, check each reading's status.
+//
+sint8 ICACHE_FLASH_ATTR
+i2c_sensor_sample(i2c_sensor_callback cb)
+{
+	sint8 status;
+	uint8 i;
+
+	if (sensor_pending)
+		return I2C_ERR_BUSY;
+	if (sensor_count == 0)
+		return I2C_ERR_NACK;
+
+	sensor_cb = cb;
+	os_memset(readings, 0, sizeof(readings));
+	sensor_pending = (1 << sensor_count) - 1;
+	sensor_queued = sensor_pending;
+	for (i = 0; i < sensor_count; i++) {
+		sensors[i].reading = &readings[i];
+		status = sensors[i].driver->start(&sensors[i]);
+		if (status != I2C_OK)
+			i2c_sensor_next(i, status);
+	}
+	if (sensor_pending) {
+		i2c_sensor_schedule();
+	} else {
+		// every start failed, still report from timer context
+		os_timer_disarm(&sensor_timer);
+		os_timer_setfn(&sensor_timer, (os_timer_func_t *)i2c_sensor_step, NULL);
+		os_timer_arm(&sensor_timer, 1, 0);
+	}
+	return I2C_OK;
+}
@@ -0,0 +1,177 @@
+/*
+    Wake cycle profiler, see include/driver/prof.h
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "user_interface.h"
+#include "driver/bitbang.h"
+#include "driver/prof.h"
+
+#if defined(PROF_ENABLE) || defined(PROF_RTC_BLOCK)
+
+#ifdef PROF_ENABLE
+extern int ets_uart_printf(const char *fmt, ...);
+
+// UART0 status register and its TX FIFO count, not every project has
+// uart_register.h
+#define PROF_UART0_STATUS	0x6000001C
+#define PROF_TXFIFO_CNT(st)	(((st) >> 16) & 0xFF)
+
+struct prof_event {
+	uint32 ccount;
+	uint16 coarse;	// system_get_time() >> 10, lets the host unwrap CCOUNT
+	uint8 probe;	// enum prof_probe, PROF_END_FLAG on the end event
+	uint8 pad;
+};
+
+static struct prof_event prof_ring[PROF_RING_SIZE];
+static uint32 prof_count;
+
+#define PROF_NAME(name)	#name,
+static const char *prof_names[PROF_PROBE_COUNT] = {
+	PROF_PROBES(PROF_NAME)
+};
+#undef PROF_NAME
+#endif
+
+#ifdef PROF_RTC_BLOCK
+static struct prof_rtc prof_now;	// this wake
+static struct prof_rtc prof_prev;	// the one before, from RTC memory
+static uint32 prof_started[PROF_PROBE_COUNT];
+static uint32 prof_open;		// probes begun and not ended
+
+//
+// Add the time since the probe began to its phase. In IRAM like
+// prof_mark(), its only caller.
+//
+LOCAL void prof_phase(uint8 probe, uint32 now)
+{
+	uint8 id = probe & ~PROF_END_FLAG;
+	uint32 ms;
+
+	if (!(probe & PROF_END_FLAG)) {
+		prof_started[id] = now;
+		prof_open |= 1 << id;
+		return;
+	}
+	if (!(prof_open & (1 << id)))
+		return;
+	prof_open &= ~(1 << id);
+	ms = prof_now.ms[id] + (now - prof_started[id]) / 1000;
+	prof_now.ms[id] = ms > 0xFFFF ? 0xFFFF : ms;
+}
+#endif
+
+//
+// Record one probe. Kept in IRAM so a probe never waits for a flash
+// cache fill, and the CCOUNT is read before anything else.
+//
+void prof_mark(uint8 probe)
+{
+#ifdef PROF_ENABLE
+	uint32 ccount = bb_ccount();
+#endif
+	uint32 now = system_get_time();
+#ifdef PROF_ENABLE
+	struct prof_event *e = &prof_ring[prof_count & (PROF_RING_SIZE - 1)];
+
+	e->ccount = ccount;
+	e->coarse = now >> 10;
+	e->probe = probe;
+	prof_count++;
+#endif
+#ifdef PROF_RTC_BLOCK
+	prof_phase(probe, now);
+#endif
+}
+
+LOCAL void ICACHE_FLASH_ATTR prof_wifi_event(System_Event_t *event)
+{
+	switch (event->event) {
+	case EVENT_STAMODE_CONNECTED:
+		PROF_END(PROF_WIFI_ASSOC);
+		PROF_BEGIN(PROF_WIFI_DHCP);
+		break;
+	case EVENT_STAMODE_GOT_IP:
+		PROF_END(PROF_WIFI_DHCP);
+		break;
+	}
+}
+
+//
+// Pick up the previous wake's times and follow the station events.
+// The RTC copy is invalidated, a wake that never reaches prof_save()
+// must not report the same figures twice.
+//
+void ICACHE_FLASH_ATTR prof_init(void)
+{
+#ifdef PROF_RTC_BLOCK
+	prof_now.boot = system_get_time() / 1000;
+	prof_now.magic = PROF_RTC_MAGIC;
+	system_rtc_mem_read(PROF_RTC_BLOCK, &prof_prev, sizeof(prof_prev));
+	if (prof_prev.magic == PROF_RTC_MAGIC) {
+		prof_prev.magic = 0;
+		system_rtc_mem_write(PROF_RTC_BLOCK, &prof_prev.magic, sizeof(prof_prev.magic));
+		prof_prev.magic = PROF_RTC_MAGIC;
+	}
+#endif
+	wifi_set_event_handler_cb(prof_wifi_event);
+}
+
+#ifdef PROF_ENABLE
+//
+// Print the ring, oldest event first, with blocking UART0 output so the
+// dump does not depend on os_printf being enabled or buffered, then
+// empty it. Returns once the UART has sent it, deep sleep may follow
+// right away.
+//
+void ICACHE_FLASH_ATTR prof_dump(void)
+{
+	uint32 i = prof_count > PROF_RING_SIZE ? prof_count - PROF_RING_SIZE : 0;
+	struct prof_event *e;
+
+	// CPU MHz, events that follow, events lost to the ring wrapping
+	ets_uart_printf("PROF start %d %d %d\r\n", system_get_cpu_freq(), prof_count - i, i);
+	for (; i < prof_count; i++) {
+		e = &prof_ring[i & (PROF_RING_SIZE - 1)];
+		ets_uart_printf("PROF %c %s %08x %d\r\n", e->probe & PROF_END_FLAG ? 'E' : 'B',
+				prof_names[e->probe & ~PROF_END_FLAG], e->ccount, e->coarse);
+	}
+	ets_uart_printf("PROF end\r\n");
+	prof_count = 0;
+	while (PROF_TXFIFO_CNT(READ_PERI_REG(PROF_UART0_STATUS)))
+		;
+}
+#endif
+
+#ifdef PROF_RTC_BLOCK
+//
+// Keep this wake's times for the next one, call right before deep sleep
+//
+void ICACHE_FLASH_ATTR prof_save(void)
+{
+	system_rtc_mem_write(PROF_RTC_BLOCK, &prof_now, sizeof(prof_now));
+}
+
+//
+// Format the previous wake's times after prefix, e.g. "&status=" or ",".
+// Writes an empty string when there are none.
+//
+void ICACHE_FLASH_ATTR prof_last_status(char *buf, const char *prefix)
+{
+	uint16 *ms = prof_prev.ms;
+
+	buf[0] = '\0';
+	if (prof_prev.magic != PROF_RTC_MAGIC)
+		return;
+	// only one sensor probe is used per project
+	os_sprintf(buf, "%swake:%d/%d/%d/%d/%d/%d/%d/%d", prefix, prof_prev.boot,
+			ms[PROF_WIFI_ASSOC], ms[PROF_WIFI_DHCP],
+			ms[PROF_DHT_READ] + ms[PROF_DS18B20] + ms[PROF_BMP180],
+			ms[PROF_HTTP_DNS], ms[PROF_HTTP_CONNECT], ms[PROF_HTTP_RESPONSE], ms[PROF_WAKE]);
+}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+/*
+    SHT30/31/35 driver for the I2C sensor registry
+
+    Every word the sensor sends is followed by a CRC-8 (polynomial 0x31,
+    init 0xFF), which is checked before a value is used.
+*/
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "c_types.h"
+#include "driver/i2c.h"
+#include "driver/i2c_sensor.h"
+#include "driver/sht3x.h"
+
+// lives in struct i2c_sensor.priv
+struct sht3x {
+	uint8 polls;
+};
+
+LOCAL uint8 ICACHE_FLASH_ATTR
+sht3x_crc(const uint8 *data)
+{
+	uint8 crc = 0xFF;
+	uint8 i, j;
+
+	for (i = 0; i < 2; i++) {
+		crc ^= data[i];
+		for (j = 0; j < 8; j++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+	}
+	return crc;
+}
+
+// Commands are 16 bit, sent like a register address plus one data byte
+LOCAL sint8 ICACHE_FLASH_ATTR
+sht3x_command(struct i2c_sensor *dev, uint16 cmd)
+{
+	uint8 lsb = cmd & 0xFF;
+
+	return i2c_write_regs(dev->addr, cmd >> 8, &lsb, 1);
+}
+
+LOCAL bool ICACHE_FLASH_ATTR
+sht3x_probe(struct i2c_sensor *dev)
+{
+	uint8 b[3];
+
+	// there is no chip id, a status word with a valid CRC has to do
+	if (sht3x_command(dev, SHT3X_CMD_READ_STATUS) != I2C_OK
+			|| i2c_read_bytes(dev->addr, b, sizeof(b)) != I2C_OK)
+		return 0;
+	return sht3x_crc(b) == b[2];
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+sht3x_started(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+
+	i2c_sensor_done(dev, txn->status != I2C_OK ? txn->status : SHT3X_MEAS_TIME);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR
+sht3x_start(struct i2c_sensor *dev)
+{
+	struct sht3x *s = (struct sht3x *)dev->priv;
+
+	s->polls = 0;
+	dev->tx[0] = SHT3X_CMD_MEASURE_HIGH >> 8;
+	dev->tx[1] = SHT3X_CMD_MEASURE_HIGH & 0xFF;
+	i2c_txn_write(&dev->txn, dev->addr, dev->tx, 2);
+	return i2c_queue_submit(&dev->txn, sht3x_started, dev);
+}
+
+LOCAL void ICACHE_FLASH_ATTR
+sht3x_fetched(struct i2c_txn *txn)
+{
+	struct i2c_sensor *dev = (struct i2c_sensor *)txn->arg;
+	struct sht3x *s = (struct sht3x *)dev->priv;
+	struct i2c_sensor_reading *r = dev->reading;
+	const uint8 *b = dev->rx;
+	uint32 raw;
+
+	// the sensor NACKs its address until the measurement is done
+	if (txn->status == I2C_ERR_NACK && ++s->polls < SHT3X_MAX_POLLS) {
+		i2c_sensor_done(dev, SHT3X_POLL_INTERVAL);
+		return;
+	}
+	if (txn->status != I2C_OK) {
+		i2c_sensor_done(dev, txn->status);
+		return;
+	}
+	if (sht3x_crc(b) != b[2] || sht3x_crc(b + 3) != b[5]) {
+		i2c_sensor_done(dev, I2C_ERR_DATA);
+		return;
+	}
+
+	// T = -45 + 175 * raw / 65535, RH = 100 * raw / 65535
+	raw = (b[0] << 8) | b[1];
+	r->temperature = -4500 + (sint32)((17500 * raw + 32767) / 65535);
+	raw = (b[3] << 8) | b[4];
+	r->humidity = (10000 * raw + 32767) / 65535;
+	r->valid = I2C_SENSOR_TEMPERATURE | I2C_SENSOR_HUMIDITY;
+	i2c_sensor_done(dev, 0);
+}
+
+LOCAL sint8 ICACHE_FLASH_ATTR
+sht3x_read(struct i2c_sensor *dev)
+{
+	i2c_txn_read(&dev->txn, dev->addr, dev->rx, 6);
+	return i2c_queue_submit(&dev->txn, sht3x_fetched, dev);
+}
+
+const struct i2c_sensor_driver sht3x_sensor = {
+	"SHT3x",
+	{ SHT3X_ADDR_LOW, SHT3X_ADDR_HIGH },
+	sht3x_probe,
+	sht3x_start,
+	sht3x_read
+};
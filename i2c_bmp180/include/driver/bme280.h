@@ -0,0 +1,41 @@
+/*
+    BMP280 / BME280 driver for the I2C sensor registry
+
+    Forced mode: every start() takes one temperature, pressure and, on
+    the BME280, humidity measurement and the chip returns to sleep.
+*/
+
+#ifndef __BME280_H__
+#define __BME280_H__
+
+#include "driver/i2c_sensor.h"
+
+#define BME280_ADDR_LOW		0x76	// SDO to GND
+#define BME280_ADDR_HIGH	0x77	// SDO to VDDIO
+
+#define BME280_CHIP_ID_REG	0xD0
+#define BMP280_CHIP_ID		0x58
+#define BME280_CHIP_ID		0x60
+#define BME280_CAL_TP_REG	0x88	// T1..P9, 24 bytes little endian
+#define BME280_CAL_H1_REG	0xA1
+#define BME280_CAL_H2_REG	0xE1	// H2..H6, 7 bytes
+#define BME280_CTRL_HUM_REG	0xF2
+#define BME280_STATUS_REG	0xF3
+#define BME280_CTRL_MEAS_REG	0xF4
+#define BME280_DATA_REG		0xF7	// press, temp, hum
+
+#define BME280_STATUS_MEASURING	0x08
+
+// oversampling x1 temperature, x4 pressure, x1 humidity, forced mode
+#define BME280_OSRS_H		0x01
+#define BME280_CTRL_MEAS	((0x01 << 5) | (0x03 << 2) | 0x01)
+
+// datasheet maximum measurement times for the settings above, ms
+#define BMP280_MEAS_TIME	14	// 1.25 + 2.3 + 2.3 * 4 + 0.575
+#define BME280_MEAS_TIME	17	// plus 2.3 + 0.575 for humidity
+#define BME280_MAX_POLLS	10	// 1 ms status polls past that time
+
+extern const struct i2c_sensor_driver bmp280_sensor;
+extern const struct i2c_sensor_driver bme280_sensor;
+
+#endif
@@ -23,8 +23,59 @@
 #include "ets_sys.h"
 #include "osapi.h"
 #include "gpio.h"
+#include "os_type.h"
+#include "user_interface.h"
 
-#define I2C_SLEEP_TIME 10 
+enum I2C_SPEED {
+    I2C_SPEED_100K,     // standard mode
+    I2C_SPEED_400K      // fast mode, BMP180 handles up to 3.4 MHz
+};
+
+#define I2C_DEFAULT_SPEED I2C_SPEED_400K
+
+// Longest a slave may stretch SCK before the transfer is abandoned, us
+#define I2C_STRETCH_TIMEOUT 500
+
+enum I2C_STATUS {
+    I2C_OK = 0,
+    I2C_ERR_NACK = -1,      // address or data byte not acknowledged
+    I2C_ERR_TIMEOUT = -2,   // SCK held low past I2C_STRETCH_TIMEOUT
+    I2C_ERR_BUS = -3,       // SDA stuck low at a start condition
+    I2C_ERR_BUSY = -4,      // a previous request has not finished yet
+    I2C_ERR_DATA = -5,      // data failed the device's checksum
+    I2C_ERR_NOT_READY = -6  // device id or calibration not read yet
+};
+
+// Transaction queue, runs as an SDK task in slices of this many us
+#define I2C_QUEUE_SLICE_US  200
+#define I2C_QUEUE_TASK_PRIO USER_TASK_PRIO_1
+#define I2C_QUEUE_EVENTS    4
+#define I2C_TXN_MAX_SEGS    3
+
+enum I2C_SEG_DIR {
+    I2C_SEG_WRITE,
+    I2C_SEG_READ
+};
+
+// A (re)start and the address in the segment's direction precede each segment
+struct i2c_segment {
+    uint8 dir;
+    uint16 len;
+    uint8 *buf;
+};
+
+struct i2c_txn;
+typedef void (*i2c_txn_callback)(struct i2c_txn *txn);
+
+struct i2c_txn {
+    uint8 dev;                  // 7 bit address
+    uint8 nseg;
+    struct i2c_segment seg[I2C_TXN_MAX_SEGS];
+    i2c_txn_callback cb;
+    void *arg;
+    sint8 status;               // I2C_OK or an I2C_ERR_* code once cb runs
+    struct i2c_txn *next;
+};
 
 // SDA on GPIO2
 #define I2C_SDA_MUX PERIPHS_IO_MUX_GPIO2_U
@@ -41,14 +92,24 @@
 //#define I2C_SCK_PIN 0
 //#define I2C_SCK_FUNC FUNC_GPIO0
 
-#define i2c_read() GPIO_INPUT_GET(GPIO_ID_PIN(I2C_SDA_PIN)); 
+#define i2c_read() ((GPIO_REG_READ(GPIO_IN_ADDRESS) >> I2C_SDA_PIN) & 1)
 
 void i2c_init(void);
+void i2c_set_speed(enum I2C_SPEED speed);
+sint8 i2c_bus_recover(void);
 void i2c_start(void);
 void i2c_stop(void);
 void i2c_send_ack(uint8 state);
 uint8 i2c_check_ack(void);
 uint8 i2c_readByte(void);
 void i2c_writeByte(uint8 data);
+sint8 i2c_read_regs(uint8 dev, uint8 reg, uint8 *buf, uint16 len);
+sint8 i2c_read_bytes(uint8 dev, uint8 *buf, uint16 len);
+sint8 i2c_write_regs(uint8 dev, uint8 reg, const uint8 *buf, uint16 len);
+void i2c_txn_read_regs(struct i2c_txn *txn, uint8 dev, uint8 *reg, uint8 *buf, uint16 len);
+void i2c_txn_read(struct i2c_txn *txn, uint8 dev, uint8 *buf, uint16 len);
+void i2c_txn_write(struct i2c_txn *txn, uint8 dev, uint8 *data, uint16 len);
+sint8 i2c_queue_submit(struct i2c_txn *txn, i2c_txn_callback cb, void *arg);
+sint32 i2c_benchmark(uint8 addr, uint16 len);
 
 #endif
@@ -28,8 +28,10 @@
 #include "c_types.h"
 #include "ets_sys.h"
 #include "osapi.h"
+#include "driver/i2c_sensor.h"
 
 #define CONVERSION_TIME				5
+#define BMP180_ADDR					0x77	// 7 bit address
 #define BMP180_W					0xEE
 #define BMP180_R					0xEF
 #define BMP180_CHIP_ID				0x5502
@@ -37,14 +39,20 @@
 #define BMP180_CHIP_ID_REG			0xD0
 #define BMP180_CTRL_REG				0xF4
 #define BMP180_DATA_REG				0xF6
+#define BMP180_CAL_REG				0xAA	// AC1..MD, 11 big endian words
+#define BMP180_CAL_LEN				22
+#define BMP180_CAL_RTC_BLOCK		64		// first RTC user memory block, 8 blocks used
+#define BMP180_CAL_RTC_MAGIC		0x42313830
 #define BMP_CMD_MEASURE_TEMP		0x2E	// Max conversion time 4.5ms
 #define BMP_CMD_MEASURE_PRESSURE_0	0x34	// Max conversion time 4.5ms (OSS = 0)
-//#define BMP_CMD_MEASURE_PRESSURE_1	0x74	// Max conversion time 7.5ms (OSS = 1)
-//#define BMP_CMD_MEASURE_PRESSURE_2	0xB4	// Max conversion time 13.5ms (OSS = 2)
-//#define BMP_CMD_MEASURE_PRESSURE_3	0xF4	// Max conversion time 25.5ms (OSS = 3)
-#define MYALTITUDE  				135.0
-
-#define BMP180_DEBUG 1
+#define BMP_CMD_MEASURE_PRESSURE_1	0x74	// Max conversion time 7.5ms (OSS = 1)
+#define BMP_CMD_MEASURE_PRESSURE_2	0xB4	// Max conversion time 13.5ms (OSS = 2)
+#define BMP_CMD_MEASURE_PRESSURE_3	0xF4	// Max conversion time 25.5ms (OSS = 3)
+#define BMP180_PRESSURE_CMD(oss)	(BMP_CMD_MEASURE_PRESSURE_0 + ((oss) << 6))
+#define BMP180_SCO_BIT				0x20	// in BMP180_CTRL_REG, set while converting
+#define BMP180_POLL_INTERVAL		1		// ms between Sco polls
+#define BMP180_B5_MAX_AGE			1000	// ms a temperature is reused for pressure
+#define MYALTITUDE  				135.0	// station altitude, m
 
 enum PRESSURE_RESOLUTION {
 	OSS_0 = 0,
@@ -53,11 +61,41 @@ enum PRESSURE_RESOLUTION {
 	OSS_3
 };
 
+#define BMP180_SENSOR_OSS	OSS_3	// pressure oversampling in the sensor registry
+
+enum bmp180_wait_mode {
+	BMP180_WAIT_POLL,	// poll the Sco bit until the conversion is done
+	BMP180_WAIT_TIMER	// wait the datasheet maximum conversion time
+};
+
+struct bmp180_result {
+	sint8 status;			// I2C_OK or an I2C_ERR_* code
+	int32_t temperature;	// 0.1 *C
+	int32_t pressure;		// Pa
+	int32_t ut;				// raw temperature
+	int32_t up;				// raw pressure, mean over the samples
+	uint8_t oss;			// oversampling setting of up
+};
+
+typedef void (*bmp180_callback)(struct bmp180_result *result);
+
+// false if the chip id or calibration could not be read; measurements
+// then retry it and fail with I2C_ERR_NOT_READY until it loads
 bool BMP180_Init(void);
-int32_t BMP180_GetTemperature();
-int32_t BMP180_GetPressure(enum PRESSURE_RESOLUTION resolution);
-int32_t BMP180_CalcAltitude(int32_t pressure);
-char* BMP180Int2String(char* buffer, int32_t value);
-char* BMP180Float2String(char* buffer, float value);
+sint8 BMP180_Measure(enum PRESSURE_RESOLUTION resolution, enum bmp180_wait_mode mode, bmp180_callback cb);
+sint8 BMP180_MeasureAverage(enum PRESSURE_RESOLUTION resolution, uint8_t samples, enum bmp180_wait_mode mode, bmp180_callback cb);
+sint8 BMP180_MeasureRaw(enum PRESSURE_RESOLUTION resolution, uint8_t samples, enum bmp180_wait_mode mode, bmp180_callback cb);
+void BMP180_GetCalibration(uint8_t *cal);
+uint16_t BMP180_CalibrationHash(void);
+
+extern const struct i2c_sensor_driver bmp180_sensor;
+// Both return I2C_OK or an I2C_ERR_* code, the result is only valid on I2C_OK
+sint8 BMP180_GetTemperature(int32_t *temperature);
+sint8 BMP180_GetPressure(enum PRESSURE_RESOLUTION resolution, int32_t *pressure);
+int32_t BMP180_Altitude(int32_t pressure, int32_t sea_level);
+int32_t BMP180_SeaLevelPressure(int32_t pressure, int32_t altitude);
+int32_t BMP180_CalcAltitude(int32_t pressure);	// sea level pressure at MYALTITUDE
+char* BMP180_Int2String(char* buffer, int32_t value);
+char* BMP180_Float2String(char* buffer, float value);
 
 #endif
@@ -0,0 +1,64 @@
+/*
+    Registry of I2C sensor drivers sharing the bit-banged bus in i2c.c
+
+    Each driver describes how to find its chip (candidate addresses and a
+    probe that checks the chip id and loads calibration) and how to take
+    a measurement in steps: start() kicks off a conversion and read() is
+    called once it is due. Both queue their transfers on dev->txn with
+    i2c_queue_submit() and return I2C_OK, or an I2C_ERR_* code if nothing
+    was queued. The driver's completion callback ends the step with
+    i2c_sensor_done(): the ms until the next read() is due, 0 when
+    dev->reading is complete, or a negative I2C_ERR_* code.
+    Conversions of all found sensors run at the same time.
+*/
+
+#ifndef __I2C_SENSOR_H__
+#define __I2C_SENSOR_H__
+
+#include "c_types.h"
+#include "driver/i2c.h"
+
+#define I2C_SENSOR_MAX		4	// devices sampled per wake
+#define I2C_SENSOR_PRIV_WORDS	12	// per device driver state, calibration etc.
+#define I2C_SENSOR_RX_LEN	12	// bytes a driver reads in one transfer
+
+// valid fields of a reading
+#define I2C_SENSOR_TEMPERATURE	0x01
+#define I2C_SENSOR_PRESSURE	0x02
+#define I2C_SENSOR_HUMIDITY	0x04
+
+struct i2c_sensor_reading {
+	sint8 status;		// I2C_OK or an I2C_ERR_* code
+	uint8 valid;		// I2C_SENSOR_* bits
+	sint32 temperature;	// 0.01 *C
+	sint32 pressure;	// Pa
+	sint32 humidity;	// 0.01 %RH
+};
+
+struct i2c_sensor;
+
+struct i2c_sensor_driver {
+	const char *name;
+	uint8 addr[2];		// 7 bit addresses to probe, 0 if unused
+	bool (*probe)(struct i2c_sensor *dev);	// synchronous, before sampling
+	sint8 (*start)(struct i2c_sensor *dev);
+	sint8 (*read)(struct i2c_sensor *dev);
+};
+
+struct i2c_sensor {
+	const struct i2c_sensor_driver *driver;
+	uint8 addr;
+	struct i2c_txn txn;			// arg is the device
+	uint8 tx[4];				// bytes txn writes
+	uint8 rx[I2C_SENSOR_RX_LEN];		// bytes txn reads
+	struct i2c_sensor_reading *reading;	// filled in by the last step
+	uint32 priv[I2C_SENSOR_PRIV_WORDS];	// word aligned for the drivers' structs
+};
+
+typedef void (*i2c_sensor_callback)(struct i2c_sensor *devs, struct i2c_sensor_reading *readings, uint8 count);
+
+uint8 i2c_sensor_init(void);
+sint8 i2c_sensor_sample(i2c_sensor_callback cb);
+void i2c_sensor_done(struct i2c_sensor *dev, sint16 next);
+
+#endif
@@ -0,0 +1,94 @@
+/*
+    Wake cycle profiler
+
+    PROF_BEGIN(id) and PROF_END(id) mark the phases of a wake cycle.
+
+    With PROF_ENABLE each mark stores the probe, the CCOUNT and a coarse
+    system_get_time() in a RAM ring of PROF_RING_SIZE events; the oldest
+    events are overwritten. prof_dump() prints and empties the ring over
+    UART0 as "PROF" lines, tools/prof_trace.py turns a log with them into
+    Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+
+    With PROF_RTC_BLOCK the milliseconds of each phase are summed.
+    prof_save() keeps them in RTC memory across deep sleep and
+    prof_last_status() formats those of the previous wake for the upload:
+    "wake:" and the times of boot (reset to prof_init), association,
+    DHCP, sensor read, DNS, connect, request to response and user_init to
+    sleep, separated by '/'.
+
+    prof_init() goes first in user_init; it ends the Wi-Fi phases on the
+    SDK station events. Without either option all of this compiles to
+    nothing. Probes are meant for task context.
+*/
+
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include "ets_sys.h"
+#include "c_types.h"
+#include "user_config.h"
+
+#define PROF_RING_SIZE	128	// events, power of two, 8 bytes each
+
+// Probe ids, shared by all projects; unused ones cost nothing
+#define PROF_PROBES(X) \
+	X(WAKE) \
+	X(WIFI_ASSOC) \
+	X(WIFI_DHCP) \
+	X(HTTP_DNS) \
+	X(HTTP_CONNECT) \
+	X(HTTP_RESPONSE) \
+	X(DHT_READ) \
+	X(DS18B20) \
+	X(BMP180) \
+	X(SLEEP)
+
+#define PROF_ENUM(name)	PROF_##name,
+enum prof_probe {
+	PROF_PROBES(PROF_ENUM)
+	PROF_PROBE_COUNT
+};
+#undef PROF_ENUM
+
+#define PROF_END_FLAG	0x80
+
+// Phase times of one wake as kept in RTC memory, 7 blocks
+struct prof_rtc {
+	uint32 magic;
+	uint32 boot;				// ms from reset to prof_init()
+	uint16 ms[(PROF_PROBE_COUNT + 1) & ~1];	// per probe, saturating
+};
+
+#define PROF_RTC_MAGIC	0x50524f46
+
+#if defined(PROF_ENABLE) || defined(PROF_RTC_BLOCK)
+
+#define PROF_BEGIN(id)	prof_mark(id)
+#define PROF_END(id)	prof_mark((id) | PROF_END_FLAG)
+
+void prof_init(void);
+void prof_mark(uint8 probe);
+
+#else
+
+#define PROF_BEGIN(id)	do {} while (0)
+#define PROF_END(id)	do {} while (0)
+#define prof_init()	do {} while (0)
+
+#endif
+
+#ifdef PROF_ENABLE
+void prof_dump(void);
+#else
+#define prof_dump()	do {} while (0)
+#endif
+
+#ifdef PROF_RTC_BLOCK
+void prof_save(void);
+void prof_last_status(char *buf, const char *prefix);
+#else
+#define prof_save()	do {} while (0)
+#define prof_last_status(buf, prefix)	((void)((buf)[0] = '\0'))
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/*
+    SHT30/31/35 driver for the I2C sensor registry
+
+    Single shot, high repeatability, without clock stretching: the sensor
+    NACKs its read address until the measurement is ready.
+*/
+
+#ifndef __SHT3X_H__
+#define __SHT3X_H__
+
+#include "driver/i2c_sensor.h"
+
+#define SHT3X_ADDR_LOW		0x44	// ADDR to GND
+#define SHT3X_ADDR_HIGH		0x45	// ADDR to VDD
+
+#define SHT3X_CMD_MEASURE_HIGH	0x2400	// single shot, high repeatability
+#define SHT3X_CMD_READ_STATUS	0xF32D
+
+#define SHT3X_MEAS_TIME		16	// ms, 15.5 max at high repeatability
+#define SHT3X_MAX_POLLS		5	// 2 ms retries while the sensor NACKs
+#define SHT3X_POLL_INTERVAL	2
+
+extern const struct i2c_sensor_driver sht3x_sensor;
+
+#endif
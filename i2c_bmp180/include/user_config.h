@@ -1,12 +1,53 @@
 #ifndef _USER_CONFIG_H_
 #define _USER_CONFIG_H_
 
-#define HTTP_DEBUG	false
-#define DHT22_DEBUG	false
+// Log level per module: LOG_NONE, LOG_ERROR, LOG_WARN, LOG_INFO or
+// LOG_DEBUG, see log.h. Messages above it are compiled out.
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX		LOG_DEBUG	// LOG_NONE for a release build
+#endif
+#define LOG_LEVEL_HTTP		LOG_ERROR
+#define LOG_LEVEL_BMP180	LOG_DEBUG
+
+// Time the wake cycle with CCOUNT probes and print them before sleeping,
+// convert the log with tools/prof_trace.py
+//#define PROF_ENABLE
+// Keep each wake's phase times in RTC memory (7 blocks) and upload them
+// with the next reading, see driver/prof.h
+#define PROF_RTC_BLOCK		74	// after the raw upload state at 72..73
 
 #define WIFI_CLIENTSSID		"BONOBO"
 #define WIFI_CLIENTPASSWORD	"FFFFEEEE00"
 
+// Print the I2C read throughput over this many bytes at boot
+//#define I2C_BENCHMARK	256
+// Print the CCOUNT cycles per BMP180_Altitude() and per pow() formula it
+// replaced, averaged over this many calls, at boot
+//#define BMP180_BENCHMARK	256
+
+// BMP180 measurements attempted per upload before waiting for the next check
+#define BMP180_READ_RETRIES	3
+// Checks per wake that start BMP180_READ_RETRIES attempts; after that the
+// upload goes without a reading and a bmp180:error status, and the node sleeps
+#define BMP180_READ_ROUNDS	3
+// BMP180_WAIT_POLL or BMP180_WAIT_TIMER, see i2c_bmp180.h
+#define BMP180_WAIT_MODE	BMP180_WAIT_POLL
+// Pressure oversampling OSS_0..OSS_3, averaged over BMP180_SAMPLES conversions
+#define BMP180_OSS		OSS_3
+#define BMP180_SAMPLES		4
+
+// Upload raw UT/UP/OSS and compensate on the collector with
+// tools/bmp180_compensate.py; the calibration block is sent until acknowledged
+//#define BMP180_RAW_UPLOAD
+#define BMP180_RAW_RTC_BLOCK	72	// after the calibration cache at 64..71
+#define BMP180_RAW_RTC_MAGIC	0x52415731
+
+// Probe for BMP180, BMP280, BME280 and SHT3x sensors and upload them all,
+// overrides BMP180_RAW_UPLOAD. Values go to these ThingSpeak fields in
+// probe order, field3 and field4 carry ADC and VDD as before.
+//#define I2C_SENSOR_REGISTRY
+#define I2C_SENSOR_FIELDS	{ 1, 2, 5, 6, 7, 8 }
+
 #define DATA_SEND_DELAY 600*1000	/* milliseconds */
 #define WIFI_CHECK_DELAY 4000	/* milliseconds */
 
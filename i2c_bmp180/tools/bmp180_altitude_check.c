@@ -0,0 +1,128 @@
+/*
+    Host check of driver/bmp180_altitude.c against the float barometric
+    formula. Fails unless BMP180_Altitude() stays within 0.7 m up to 3 km
+    and 3 m up to 10 km, and BMP180_SeaLevelPressure() within 2.5 Pa
+    between -512 and 3584 m, for sea level pressures of 950..1050 hPa.
+    Also prints the host time per call of both against the pow() path;
+    build with BMP180_BENCHMARK in user_config.h for CCOUNT figures from
+    the target.
+
+    cc -O2 -I include -o bmp180_altitude_check tools/bmp180_altitude_check.c -lm
+    ./bmp180_altitude_check
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// stand in for the SDK headers, driver/i2c_bmp180.h is skipped
+#define __I2C_BMP180_H
+#define ICACHE_FLASH_ATTR
+int32_t BMP180_Altitude(int32_t pressure, int32_t sea_level);
+int32_t BMP180_SeaLevelPressure(int32_t pressure, int32_t altitude);
+
+#include "../driver/bmp180_altitude.c"
+
+#define ROUNDS	2000000
+
+static const int32_t sea_levels[] = { 95000, 101325, 105000 };
+
+static int failed;
+
+static double station_pressure(double sea_level, double altitude)
+{
+	return sea_level * pow(1 - altitude / 44330, 5.255);
+}
+
+//
+// Worst error of BMP180_Altitude() in m for altitudes from..to m
+//
+static double altitude_error(int32_t sea_level, int from, int to)
+{
+	double worst = 0, h, err;
+	int32_t p;
+
+	for (p = (int32_t)station_pressure(sea_level, to); p <= (int32_t)station_pressure(sea_level, from); p++) {
+		h = 44330 * (1 - pow((double)p / sea_level, 1 / 5.255));
+		err = fabs(BMP180_Altitude(p, sea_level) / 10.0 - h);
+		if (err > worst)
+			worst = err;
+	}
+	return worst;
+}
+
+//
+// Worst error of BMP180_SeaLevelPressure() in Pa over -512..3584 m
+//
+static double sea_level_error(int32_t sea_level)
+{
+	double worst = 0, err;
+	int32_t h, p;
+
+	for (h = -5120; h < 35840; h++) {
+		p = (int32_t)(station_pressure(sea_level, h / 10.0) + 0.5);
+		err = fabs(BMP180_SeaLevelPressure(p, h) - p / pow(1 - h / 443300.0, 5.255));
+		if (err > worst)
+			worst = err;
+	}
+	return worst;
+}
+
+static void check(const char *what, int32_t sea_level, double err, double bound)
+{
+	printf("%-28s p0 %6d Pa: %.3f (max %.1f)%s\n", what, sea_level, err, bound,
+			err > bound ? " FAIL" : "");
+	if (err > bound)
+		failed = 1;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void timing(void)
+{
+	volatile int32_t sink, altitude = 1350;	// 0.1 m, opaque to the compiler
+	double t0, fixed_alt, float_alt, fixed_slp, float_slp;
+	int32_t i;
+
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink = BMP180_Altitude(101325 - (i & 0x7FFF), 101325);
+	fixed_alt = (now_ns() - t0) / ROUNDS;
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink = (int32_t)(443300 * (1 - powf((float)(101325 - (i & 0x7FFF)) / 101325, 1 / 5.255F)));
+	float_alt = (now_ns() - t0) / ROUNDS;
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink = BMP180_SeaLevelPressure(99000 + (i & 0x7FF), altitude);
+	fixed_slp = (now_ns() - t0) / ROUNDS;
+	// as BMP180_CalcAltitude() did before the tables
+	t0 = now_ns();
+	for (i = 0; i < ROUNDS; i++)
+		sink = (int32_t)(pow(((float)altitude / 443300) + 1, 5.255F) * (99000 + (i & 0x7FF)));
+	float_slp = (now_ns() - t0) / ROUNDS;
+	(void)sink;
+
+	printf("host ns/call: altitude %.1f, pow() %.1f; sea level %.1f, pow() %.1f\n",
+			fixed_alt, float_alt, fixed_slp, float_slp);
+}
+
+int main(void)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(sea_levels) / sizeof(sea_levels[0]); i++) {
+		check("altitude 0..3000 m, m", sea_levels[i], altitude_error(sea_levels[i], 0, 3000), 0.7);
+		check("altitude 0..10000 m, m", sea_levels[i], altitude_error(sea_levels[i], 0, 10000), 3.0);
+		check("sea level -512..3584 m, Pa", sea_levels[i], sea_level_error(sea_levels[i]), 2.5);
+	}
+	timing();
+	return failed;
+}
@@ -0,0 +1,138 @@
+#!/usr/bin/env python
+"""
+Batch compensation of raw BMP180 samples uploaded with BMP180_RAW_UPLOAD.
+
+Reproduces BMP180_calcB5()/BMP180_calcPressure() from driver/i2c_bmp180.c
+bit for bit, including C's truncating division and 32 bit wrap-around.
+
+Input is either a ThingSpeak feed export (CSV with a header, field1 = UT,
+field2 = UP, field5 = OSS, a "cal:<44 hex digits>" token in the status
+whenever the calibration changed) or plain "ut up oss" lines together
+with --cal. The status is a comma separated list, other tokens such as
+the wake times are ignored. With the datasheet's example calibration
+and readings this row gives "150 69964":
+
+    created_at,entry_id,field1,field2,field3,field4,field5,field6,status
+    2026-10-19 16:00:00 UTC,1,27898,23843,512,3300,0,41245,"cal:0198ffb8c7d17fe57ff55a71182e00048000ddf90b34,wake:61/1180/410/52/38/95/120/1930"
+
+Output is one "temperature_0.1C pressure_Pa" line per sample, prefixed
+with the timestamp for ThingSpeak input.
+
+    bmp180_compensate.py --cal aabbcc... samples.txt
+    bmp180_compensate.py feeds.csv
+"""
+
+import argparse
+import csv
+import sys
+
+
+def s32(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def u32(v):
+    return v & 0xFFFFFFFF
+
+
+def cdiv(a, b):
+    # C integer division truncates toward zero
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b >= 0) else -q
+
+
+class Calibration(object):
+    def __init__(self, hexstr):
+        raw = bytearray.fromhex(hexstr.strip())
+        if len(raw) != 22:
+            raise ValueError("calibration block must be 22 bytes")
+        words = [(raw[2 * i] << 8) | raw[2 * i + 1] for i in range(11)]
+        signed = [w - 0x10000 if w & 0x8000 else w for w in words]
+        (self.ac1, self.ac2, self.ac3) = signed[0:3]
+        (self.ac4, self.ac5, self.ac6) = words[3:6]
+        (self.b1, self.b2, self.mb, self.mc, self.md) = signed[6:11]
+
+    def b5(self, ut):
+        x1 = s32((ut - self.ac6) * self.ac5) >> 15
+        x2 = cdiv(s32(self.mc << 11), s32(x1 + self.md))
+        return s32(x1 + x2)
+
+    def pressure(self, up, b5, oss):
+        b6 = b5 - 4000
+        x1 = s32(self.b2 * (s32(b6 * b6) >> 12)) >> 11
+        x2 = s32(self.ac2 * b6) >> 11
+        x3 = x1 + x2
+        b3 = s32((s32(self.ac1 * 4 + x3) << oss) + 2) >> 2
+        x1 = s32(self.ac3 * b6) >> 13
+        x2 = s32(self.b1 * (s32(b6 * b6) >> 12)) >> 16
+        x3 = (x1 + x2 + 2) >> 2
+        b4 = u32(self.ac4 * u32(x3 + 32768)) >> 15
+        b7 = u32(u32(up - b3) * (50000 >> oss))
+        if b7 < 0x80000000:
+            p = s32(u32(b7 * 2) // b4)
+        else:
+            p = s32(u32((b7 // b4) * 2))
+        x1 = s32((p >> 8) * (p >> 8))
+        x1 = s32(x1 * 3038) >> 16
+        x2 = s32(-7357 * p) >> 16
+        return s32(p + ((x1 + x2 + 3791) >> 4))
+
+    def compensate(self, ut, up, oss):
+        b5 = self.b5(ut)
+        return (b5 + 8) >> 4, self.pressure(up, b5, oss)
+
+
+def status_token(status, name):
+    """Value of the name:value token in a comma separated status, or None."""
+    for token in (status or "").split(","):
+        key, sep, value = token.strip().partition(":")
+        if sep and key == name:
+            return value
+    return None
+
+
+def thingspeak(rows, cal, out):
+    for row in rows:
+        block = status_token(row.get("status"), "cal")
+        if block is not None:
+            cal = Calibration(block)
+        if not row.get("field1") or not row.get("field2"):
+            continue
+        if cal is None:
+            sys.stderr.write("skipping %s: no calibration yet\n" % row.get("created_at"))
+            continue
+        t, p = cal.compensate(int(row["field1"]), int(row["field2"]), int(row.get("field5") or 0))
+        out.write("%s %d %d\n" % (row.get("created_at", ""), t, p))
+
+
+def plain(lines, cal, out):
+    for line in lines:
+        fields = line.replace(",", " ").split()
+        if len(fields) < 2 or fields[0].startswith("#"):
+            continue
+        oss = int(fields[2]) if len(fields) > 2 else 0
+        t, p = cal.compensate(int(fields[0]), int(fields[1]), oss)
+        out.write("%d %d\n" % (t, p))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Compensate raw BMP180 samples")
+    ap.add_argument("--cal", help="calibration block, 44 hex digits")
+    ap.add_argument("input", nargs="?", help="samples, default stdin")
+    args = ap.parse_args()
+
+    src = open(args.input) if args.input else sys.stdin
+    cal = Calibration(args.cal) if args.cal else None
+    first = src.readline()
+    if first.startswith("created_at"):
+        rows = csv.DictReader([first] + src.readlines())
+        thingspeak(rows, cal, sys.stdout)
+    else:
+        if cal is None:
+            ap.error("--cal is required for plain input")
+        plain([first] + src.readlines(), cal, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -7,6 +7,12 @@
 #include "user_config.h"
 #include "driver/i2c.h"
 #include "driver/i2c_bmp180.h"
+#include "driver/i2c_sensor.h"
+#include "driver/prof.h"
+#ifdef BMP180_BENCHMARK
+#include <math.h>
+#include "driver/bitbang.h"
+#endif
 
 //#include "driver/uart.h"
 
@@ -29,21 +35,63 @@ LOCAL void ICACHE_FLASH_ATTR setup_wifi_st_mode(void);
 static struct ip_info ipConfig;
 static ETSTimer WiFiLinker;
 
+static struct bmp180_result bmp_data;
+static int bmp_ready = 0;
+static int bmp_busy = 0;
+static int bmp_retries = 0;
+static int bmp_rounds = 0;	// rounds of retries started this wake
+
 int ds18b20();
 
 static ETSTimer sleep_timer;
 LOCAL void ICACHE_FLASH_ATTR sleep_cb(void *arg)
 {
     os_timer_disarm(&sleep_timer);
+    PROF_END(PROF_WAKE);
+    prof_save();
+    prof_dump();
     system_deep_sleep_set_option( 1 );
     system_deep_sleep(DATA_SEND_DELAY*1000);//second*1000*1000
 }
 
+#ifdef BMP180_RAW_UPLOAD
+// Hash of the calibration block the collector last acknowledged
+struct bmp180_cal_sent {
+	uint32 magic;
+	uint16 hash;
+	uint16 pad;
+};
+
+static uint16 bmp_cal_hash;
+
+LOCAL bool ICACHE_FLASH_ATTR bmp180_cal_known(void)
+{
+	struct bmp180_cal_sent sent;
+
+	system_rtc_mem_read(BMP180_RAW_RTC_BLOCK, &sent, sizeof(sent));
+	return sent.magic == BMP180_RAW_RTC_MAGIC && sent.hash == bmp_cal_hash;
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_cal_acked(void)
+{
+	struct bmp180_cal_sent sent;
+
+	sent.magic = BMP180_RAW_RTC_MAGIC;
+	sent.hash = bmp_cal_hash;
+	sent.pad = 0;
+	system_rtc_mem_write(BMP180_RAW_RTC_BLOCK, &sent, sizeof(sent));
+}
+#endif
+
 LOCAL void ICACHE_FLASH_ATTR thingspeak_http_callback(char * response, int http_status, char * full_response)
 {
 	if (http_status == 200)
 	{
         os_timer_disarm(&WiFiLinker);
+#ifdef BMP180_RAW_UPLOAD
+        if (bmp_ready)
+            bmp180_cal_acked();
+#endif
 
         os_timer_disarm(&sleep_timer);
         os_timer_setfn(&sleep_timer, sleep_cb, NULL);
@@ -88,24 +136,177 @@ void user_rf_pre_init(void)
 {
 }
 
+#ifdef I2C_SENSOR_REGISTRY
+static struct i2c_sensor_reading sensor_data[I2C_SENSOR_MAX];
+static uint8 sensor_count = 0;
+static uint8 sensors_found = 0;	// by the last i2c_sensor_init()
+static const uint8 sensor_fields[] = I2C_SENSOR_FIELDS;
+
+LOCAL void ICACHE_FLASH_ATTR sensors_sampled(struct i2c_sensor *devs, struct i2c_sensor_reading *readings, uint8 count);
+
+// 0.01 units to "x.xx"
+LOCAL char * ICACHE_FLASH_ATTR sensor_format(char *buff, sint32 value)
+{
+	os_sprintf(buff, "%s%d.%02d", value < 0 ? "-" : "", (value < 0 ? -value : value) / 100, (value < 0 ? -value : value) % 100);
+	return buff;
+}
+#endif
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_measured(struct bmp180_result *result);
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_start(void)
+{
+	PROF_BEGIN(PROF_BMP180);
+#if defined(I2C_SENSOR_REGISTRY)
+	// nothing answered the last probe, look again once per round; the
+	// rounds are bounded, so an empty bus still ends in an upload and sleep
+	if (!sensors_found && bmp_retries == 0)
+		sensors_found = i2c_sensor_init();
+	bmp_busy = i2c_sensor_sample(sensors_sampled) == I2C_OK;
+#elif defined(BMP180_RAW_UPLOAD)
+	bmp_busy = BMP180_MeasureRaw(BMP180_OSS, BMP180_SAMPLES, BMP180_WAIT_MODE, bmp180_measured) == I2C_OK;
+#else
+	bmp_busy = BMP180_MeasureAverage(BMP180_OSS, BMP180_SAMPLES, BMP180_WAIT_MODE, bmp180_measured) == I2C_OK;
+#endif
+}
+
+#ifdef BMP180_BENCHMARK
+// Cycles per call of the fixed point altitude and of the soft-float
+// pow() formula, see tools/bmp180_altitude_check.c for the accuracy
+LOCAL void ICACHE_FLASH_ATTR bmp180_benchmark(void)
+{
+	volatile int32_t sink;
+	uint32 start, fixed, flt;
+	int32_t i;
+
+	start = bb_ccount();
+	for (i = 0; i < BMP180_BENCHMARK; i++)
+		sink = BMP180_Altitude(101325 - i * 16, 101325);
+	fixed = (bb_ccount() - start) / BMP180_BENCHMARK;
+	start = bb_ccount();
+	for (i = 0; i < BMP180_BENCHMARK; i++)
+		sink = (int32_t)(443300 * (1 - pow((float)(101325 - i * 16) / 101325, 1 / 5.255F)));
+	flt = (bb_ccount() - start) / BMP180_BENCHMARK;
+	(void)sink;
+	os_printf("BMP180 altitude: %d cycles, pow() %d cycles\r\n", fixed, flt);
+}
+#endif
+
+// Start a round of up to BMP180_READ_RETRIES measurements
+LOCAL void ICACHE_FLASH_ATTR bmp180_round(void)
+{
+	bmp_rounds++;
+	bmp_retries = 0;
+	bmp180_start();
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_done(int success)
+{
+	PROF_END(PROF_BMP180);
+	bmp_busy = 0;
+	if (!success) {
+		// the bus has already been recovered, so retry at once; once the
+		// retries are used up the next wifi_check_ip tick starts over
+		if (++bmp_retries < BMP180_READ_RETRIES)
+			bmp180_start();
+		return;
+	}
+	bmp_ready = 1;
+
+	// Wi-Fi may have come up while the sensor was converting
+	if (wifi_station_get_connect_status() == STATION_GOT_IP)
+		ds18b20();
+}
+
+LOCAL void ICACHE_FLASH_ATTR bmp180_measured(struct bmp180_result *result)
+{
+	if (result->status == I2C_OK)
+		bmp_data = *result;
+	bmp180_done(result->status == I2C_OK);
+}
+
+#ifdef I2C_SENSOR_REGISTRY
+LOCAL void ICACHE_FLASH_ATTR sensors_sampled(struct i2c_sensor *devs, struct i2c_sensor_reading *readings, uint8 count)
+{
+	uint8 i, good = 0;
+
+	for (i = 0; i < count; i++)
+		if (readings[i].status == I2C_OK)
+			good++;
+	if (good) {
+		os_memcpy(sensor_data, readings, count * sizeof(*readings));
+		sensor_count = count;
+	}
+	bmp180_done(good > 0);
+}
+#endif
+
 int ICACHE_FLASH_ATTR ds18b20()
 {
     static char http_data[256];
     uint16 adc = 0;
     unsigned int vdd = 0;
+#if defined(I2C_SENSOR_REGISTRY)
+	char buff[20];
+    struct i2c_sensor_reading *r;
+    int len, i, f;
+#elif defined(BMP180_RAW_UPLOAD)
+    uint8 cal[BMP180_CAL_LEN];
+    int len, i;
+#else
+	char buff[20];
+#endif
+
+    if (!bmp_ready) {
+        if (bmp_busy)
+            return 0;
+        if (bmp_rounds < BMP180_READ_ROUNDS) {
+            bmp180_round();
+            return 0;
+        }
+        // no reading this wake: report that and sleep rather than keep
+        // Wi-Fi up retrying a dead sensor
+        os_sprintf(http_data, "http://%s/update?key=%s&field3=%d&field4=%d&status=bmp180:error", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, system_adc_read(), readvdd33());
+        prof_last_status(http_data + os_strlen(http_data), ",");
+        http_get(http_data, "", thingspeak_http_callback);
+        return 1;
+    }
 
     adc = system_adc_read();
     vdd = readvdd33();
 
-    // Start the connection process
-    int32_t temperature;
-    int32_t pressure;
-	char buff[20];
-
-    temperature = BMP180_GetTemperature();
-    pressure = BMP180_GetPressure(OSS_0);
-
-    os_sprintf(http_data, "http://%s/update?key=%s&field1=%s&field2=%d&field3=%d&field4=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, BMP180_Int2String(buff, temperature), (int)(pressure/133.322368), adc, vdd);
+#if defined(I2C_SENSOR_REGISTRY)
+    // sensors in probe order fill I2C_SENSOR_FIELDS: temperature, then
+    // pressure and/or humidity
+    len = os_sprintf(http_data, "http://%s/update?key=%s&field3=%d&field4=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, adc, vdd);
+    for (i = 0, f = 0; i < sensor_count; i++) {
+        r = &sensor_data[i];
+        if (r->status != I2C_OK)
+            continue;
+        if ((r->valid & I2C_SENSOR_TEMPERATURE) && f < sizeof(sensor_fields))
+            len += os_sprintf(http_data + len, "&field%d=%s", sensor_fields[f++], sensor_format(buff, r->temperature));
+        if ((r->valid & I2C_SENSOR_PRESSURE) && f < sizeof(sensor_fields))
+            len += os_sprintf(http_data + len, "&field%d=%d", sensor_fields[f++], (r->pressure * 1000 + 66661) / 133322);
+        if ((r->valid & I2C_SENSOR_HUMIDITY) && f < sizeof(sensor_fields))
+            len += os_sprintf(http_data + len, "&field%d=%s", sensor_fields[f++], sensor_format(buff, r->humidity));
+    }
+#elif defined(BMP180_RAW_UPLOAD)
+    // field1 UT, field2 UP, field5 OSS, field6 calibration hash; the block
+    // itself rides along in the status until the collector has seen it
+    bmp_cal_hash = BMP180_CalibrationHash();
+    len = os_sprintf(http_data, "http://%s/update?key=%s&field1=%d&field2=%d&field3=%d&field4=%d&field5=%d&field6=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, bmp_data.ut, bmp_data.up, adc, vdd, bmp_data.oss, bmp_cal_hash);
+    if (!bmp180_cal_known()) {
+        BMP180_GetCalibration(cal);
+        len += os_sprintf(http_data + len, "&status=cal:");
+        for (i = 0; i < BMP180_CAL_LEN; i++)
+            len += os_sprintf(http_data + len, "%02x", cal[i]);
+    }
+#else
+    // Pa to mmHg, 1 mmHg = 133.322 Pa, rounded
+    os_sprintf(http_data, "http://%s/update?key=%s&field1=%s&field2=%d&field3=%d&field4=%d", THINGSPEAK_SERVER, THINGSPEAK_API_KEY, BMP180_Int2String(buff, bmp_data.temperature), (bmp_data.pressure * 1000 + 66661) / 133322, adc, vdd);
+#endif
+    // phase times of the previous wake, after the calibration if it is sent
+    prof_last_status(http_data + os_strlen(http_data), os_strstr(http_data, "&status=") ? "," : "&status=");
     http_get(http_data, "", thingspeak_http_callback);
 
     return 1;
@@ -113,6 +314,9 @@ int ICACHE_FLASH_ATTR ds18b20()
 
 void user_init(void)
 {
+    prof_init();
+    PROF_BEGIN(PROF_WAKE);
+    PROF_BEGIN(PROF_WIFI_ASSOC);
     system_set_os_print(0);
 //    uart_init(BIT_RATE_115200, BIT_RATE_115200);
 //    os_delay_us(1000);
@@ -128,7 +332,23 @@ void user_init(void)
 	if(wifi_station_get_auto_connect() == 0)
 		wifi_station_set_auto_connect(1);
 
+#ifdef I2C_SENSOR_REGISTRY
+    sensors_found = i2c_sensor_init();
+#else
+    // a failed calibration read is retried by each measurement
     BMP180_Init();
+#endif
+#ifdef I2C_BENCHMARK
+    system_set_os_print(1);
+    os_printf("I2C: %d bytes/s\r\n", i2c_benchmark(BMP180_ADDR, I2C_BENCHMARK));
+    system_set_os_print(0);
+#endif
+#ifdef BMP180_BENCHMARK
+    system_set_os_print(1);
+    bmp180_benchmark();
+    system_set_os_print(0);
+#endif
+    bmp180_round();
 
 	// Wait for Wi-Fi connection
 	os_timer_disarm(&WiFiLinker);